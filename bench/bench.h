@@ -0,0 +1,146 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#define BENCH_ITERATIONS 1000000
+#define BENCH_LATENCY_ITERATIONS 200000	/* Calls per bench_latency run, split across its threads */
+
+static inline uint64_t bench_now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Keeps the compiler from optimizing away results */
+#define bench_use(value)	__asm__ volatile("" : : "g"(value) : "memory")
+
+/* Runs statement BENCH_ITERATIONS times and prints average ns/call */
+#define BENCH(name, statement)											\
+	do {																\
+		uint64_t _start = bench_now_ns();								\
+		for (long _i = 0; _i < BENCH_ITERATIONS; _i++) {				\
+			statement;													\
+		}																\
+		double _ns = (double)(bench_now_ns() - _start) / BENCH_ITERATIONS;	\
+		printf("%-48s %10.1f ns/call\n", name, _ns);					\
+	} while (0)
+
+typedef void (*bench_call)(long i);
+
+typedef struct {
+	bench_call call;
+	long iterations;
+	uint64_t *samples;			/* NULL for the un-instrumented pass */
+	pthread_barrier_t *barrier;
+	uint64_t start, end;
+} BenchThread;
+
+static int bench_compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void *bench_thread_main(void *arg)
+{
+	BenchThread *t = (BenchThread *)arg;
+
+	pthread_barrier_wait(t->barrier);
+	t->start = bench_now_ns();
+	if (!t->samples) {
+		for (long i = 0; i < t->iterations; i++)
+			t->call(i);
+	}
+	else {
+		for (long i = 0; i < t->iterations; i++) {
+			uint64_t start = bench_now_ns();
+
+			t->call(i);
+			t->samples[i] = bench_now_ns() - start;
+		}
+	}
+	t->end = bench_now_ns();
+	return NULL;
+}
+
+/* Runs call per_thread times on each of threads, samples[] gets per-call latencies if not NULL. Returns the wall time of the calls */
+static inline uint64_t bench_run(int threads, long per_thread, bench_call call, uint64_t *samples)
+{
+	BenchThread *t = (BenchThread *)calloc(threads, sizeof(*t));
+	pthread_t *tid = (pthread_t *)calloc(threads, sizeof(*tid));
+	pthread_barrier_t barrier;
+	uint64_t start = UINT64_MAX, end = 0;
+
+	if (!t || !tid) {
+		perror("malloc");
+		exit(1);
+	}
+	pthread_barrier_init(&barrier, NULL, threads);
+	for (int i = 0; i < threads; i++) {
+		t[i] = (BenchThread){ .call = call, .iterations = per_thread, .samples = samples ? samples + i * per_thread : NULL, .barrier = &barrier };
+		if (pthread_create(&tid[i], NULL, bench_thread_main, &t[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (int i = 0; i < threads; i++) {
+		pthread_join(tid[i], NULL);
+		start = t[i].start < start ? t[i].start : start;
+		end = t[i].end > end ? t[i].end : end;
+	}
+	pthread_barrier_destroy(&barrier);
+	free(t);
+	free(tid);
+	return end - start;
+}
+
+/*
+ * Runs call BENCH_LATENCY_ITERATIONS times spread over threads, twice: a plain loop gives ns/call (wall time of
+ * the calls / calls) and lines/s, then a loop that reads the clock around every call gives the latency
+ * percentiles, which include one clock_gettime(2) of overhead. lines is false for calls that mostly write no
+ * line (filtered, rate limited, deduplicated), which leaves out lines/s
+ */
+static inline void bench_latency_lines(FILE *out, const char *name, int threads, bench_call call, int lines)
+{
+	long per_thread = BENCH_LATENCY_ITERATIONS / threads, total = per_thread * threads;
+	uint64_t *samples = (uint64_t *)malloc(total * sizeof(*samples));
+	uint64_t elapsed;
+	char rate[32] = "";
+
+	if (!samples) {
+		perror("malloc");
+		exit(1);
+	}
+	elapsed = bench_run(threads, per_thread, call, NULL);
+	bench_run(threads, per_thread, call, samples);
+
+	qsort(samples, total, sizeof(*samples), bench_compare_u64);
+	if (lines)
+		snprintf(rate, sizeof(rate), "%10.0f lines/s", total / (elapsed / 1e9));
+	fprintf(out, "%-40s %2dT %8.1f ns/call %17s  p50 %6lu  p99 %7lu  p999 %8lu ns\n", name, threads,
+		(double)elapsed / total, rate,
+		(unsigned long)samples[total / 2], (unsigned long)samples[total * 99 / 100], (unsigned long)samples[total * 999 / 1000]);
+	fflush(out);
+	free(samples);
+}
+
+static inline void bench_latency(FILE *out, const char *name, int threads, bench_call call)
+{
+	bench_latency_lines(out, name, threads, call, 1);
+}
+
+/* For calls that mostly write no line */
+static inline void bench_latency_no_lines(FILE *out, const char *name, int threads, bench_call call)
+{
+	bench_latency_lines(out, name, threads, call, 0);
+}
+
+#endif /* _BENCH_H */
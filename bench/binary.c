@@ -0,0 +1,48 @@
+/* Call-site cost of binary (deferred-formatting) mode against formatting in place, all behind the async ring */
+#include <log.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bench.h"
+
+static void integer_heavy(long i)
+{
+	lprintf("[INFO]: id=%d seq=%u off=%x len=%d err=%d port=%u\n", (int)i, (unsigned)i * 7, (unsigned)i * 4096, (int)(i & 1023), -(int)(i & 15), 8080u);
+}
+
+static void float_and_string(long i)
+{
+	lprintf("[INFO]: user=%s took %.3f ms\n", "alpha", i * 0.001);
+}
+
+static void run(FILE *out, const char *mode)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "%s, integer-heavy", mode);
+	bench_latency(out, name, 1, integer_heavy);
+	snprintf(name, sizeof(name), "%s, float and string", mode);
+	bench_latency(out, name, 1, float_and_string);
+	lasync_flush();
+}
+
+int main()
+{
+	FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+	int devnull = open("/dev/null", O_WRONLY);
+
+	setup_lstdio();
+	dup2(devnull, STDOUT_FILENO);
+	lasync_start(1 << 24, LASYNC_BLOCK);
+	run(out, "async text");
+	lbinary_start(-1);
+	run(out, "async deferred");
+	lbinary_stop();
+	lbinary_start(devnull);
+	run(out, "async binary stream");
+	lbinary_stop();
+	lasync_stop();
+	lbinary_start(devnull);
+	run(out, "sync binary stream");
+	lbinary_stop();
+	return 0;
+}
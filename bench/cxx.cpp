@@ -0,0 +1,150 @@
+/* log.hpp's compile-time parsed formats vs. lprintf, formatting alone and whole calls */
+#include <log.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include "bench.h"
+
+static char long_string[1024];
+static const char *short_strings[] = { "alpha", "beta", "gamma", "delta" };
+
+/* Output of the generated formatter has to match npf_snprintf's for the same format */
+template <logging::Format F, class... Args>
+static int check(const Args &...args)
+{
+	char expected[512], got[512];
+	int n = npf_snprintf(expected, sizeof(expected), F.text, args...);
+	int m = logging::detail::format<F>(got, sizeof(got), args...);
+
+	if (m < (int)sizeof(got))
+		got[m] = '\0';
+	if (n != m || strcmp(expected, got)) {
+		printf("MISMATCH for \"%s\": \"%s\" (%d) vs. \"%s\" (%d)\n", F.text, expected, n, got, m);
+		return 1;
+	}
+	return 0;
+}
+
+static int check_formats()
+{
+	int failed = 0;
+
+	failed += check<"[INFO]: plain\n">();
+	failed += check<"%d %d %u %x %X %o\n">(0, -2147483647 - 1, 4294967295u, 0xdeadbeefu, 0xabcu, 8u);
+	failed += check<"%ld %lu %lld %llx %zu\n">(-1234567890123l, 1ul << 63, -1ll, 0x1234567890abcdefull, (size_t)42);
+	failed += check<"%5d|%-5d|%05d|%+d|% d|%.3d\n">(42, 42, -42, 7, 7, 5);
+	failed += check<"%s|%10s|%-10s|%.2s|%c|%%\n">("str", "right", "left", "cut", 'z');
+	failed += check<"%f %.3f %e %g %10.2f\n">(3.14159, -0.0005, 12345.678, 0.0001, 2.5);
+	failed += check<"%p %#x %#o\n">((void *)0x1000, 255u, 8u);
+	return failed;
+}
+
+static void npf_line(char *buf, long i)
+{
+	npf_snprintf(buf, 256, "id=%d seq=%u off=%x len=%d err=%d port=%u\n", (int)i, (unsigned)i * 7, (unsigned)i * 4096, (int)(i & 1023), -(int)(i & 15), 8080u);
+}
+
+static void cxx_line(char *buf, long i)
+{
+	logging::detail::format<"id=%d seq=%u off=%x len=%d err=%d port=%u\n">(buf, 256, (int)i, (unsigned)i * 7, (unsigned)i * 4096, (int)(i & 1023), -(int)(i & 15), 8080u);
+}
+
+static void c_filtered(long i) { lprintf("[DEBUG]: filtered %d %s\n", (int)i, "x"); }
+static void cxx_filtered(long i) { logging::print<"[DEBUG]: filtered %d %s\n">((int)i, "x"); }
+static void c_short(long i) { (void)i; lprintf("[INFO]: x\n"); }
+static void cxx_short(long i) { (void)i; logging::print<"[INFO]: x\n">(); }
+static void c_long(long i) { (void)i; lprintf("[INFO]: %s\n", long_string); }
+static void cxx_long(long i) { (void)i; logging::print<"[INFO]: %s\n">(long_string); }
+
+static void c_integer(long i)
+{
+	lprintf("[INFO]: id=%d seq=%u off=%x len=%d err=%d port=%u\n", (int)i, (unsigned)i * 7, (unsigned)i * 4096, (int)(i & 1023), -(int)(i & 15), 8080u);
+}
+
+static void cxx_integer(long i)
+{
+	logging::print<"[INFO]: id=%d seq=%u off=%x len=%d err=%d port=%u\n">((int)i, (unsigned)i * 7, (unsigned)i * 4096, (int)(i & 1023), -(int)(i & 15), 8080u);
+}
+
+static void c_float(long i)
+{
+	lprintf("[INFO]: t=%f load=%.3f ratio=%.6f temp=%.1f\n", i * 0.001, i * 1.5, 1.0 / (i + 1), 36.6 + (i & 7));
+}
+
+static void cxx_float(long i)
+{
+	logging::print<"[INFO]: t=%f load=%.3f ratio=%.6f temp=%.1f\n">(i * 0.001, i * 1.5, 1.0 / (i + 1), 36.6 + (i & 7));
+}
+
+static void c_string(long i)
+{
+	lprintf("[INFO]: user=%s host=%s path=%s method=%s\n", short_strings[i & 3], short_strings[(i + 1) & 3], short_strings[(i + 2) & 3], short_strings[(i + 3) & 3]);
+}
+
+static void cxx_string(long i)
+{
+	logging::print<"[INFO]: user=%s host=%s path=%s method=%s\n">(short_strings[i & 3], short_strings[(i + 1) & 3], short_strings[(i + 2) & 3], short_strings[(i + 3) & 3]);
+}
+
+static void c_level(long i) { llprintf(LOG_INFO, "request %d done\n", (int)i); }
+static void cxx_level(long i) { logging::info<"request %d done\n">((int)i); }
+
+static const struct {
+	const char *name;
+	bench_call c, cxx;
+} shapes[] = {
+	{ "filtered [DEBUG]", c_filtered, cxx_filtered },
+	{ "short line", c_short, cxx_short },
+	{ "long line (1023 chars)", c_long, cxx_long },
+	{ "integer-heavy", c_integer, cxx_integer },
+	{ "float-heavy", c_float, cxx_float },
+	{ "string-heavy", c_string, cxx_string },
+	{ "LOG_INFO", c_level, cxx_level },
+};
+
+static void run_shapes(FILE *out)
+{
+	char name[64];
+
+	for (const auto &s : shapes) {
+		int lines = s.c != c_filtered;
+
+		snprintf(name, sizeof(name), "lprintf, %s", s.name);
+		bench_latency_lines(out, name, 1, s.c, lines);
+		snprintf(name, sizeof(name), "logging::print, %s", s.name);
+		bench_latency_lines(out, name, 1, s.cxx, lines);
+	}
+}
+
+int main()
+{
+	char buf[256];
+	FILE *out;
+	int devnull = open("/dev/null", O_WRONLY);
+
+	if (check_formats())
+		return 1;
+	BENCH("npf_snprintf, integer-heavy", npf_line(buf, _i); bench_use(buf));
+	BENCH("logging::detail::format, integer-heavy", cxx_line(buf, _i); bench_use(buf));
+
+	fflush(stdout);
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	if (!out || devnull < 0) {
+		perror("open");
+		return 1;
+	}
+	memset(long_string, 'x', sizeof(long_string) - 1);
+	setenv("LOG_LEVEL", "INFO", 1);
+	setup_lstdio();
+	dup2(devnull, STDOUT_FILENO);
+	dup2(devnull, STDERR_FILENO);
+
+	fprintf(out, "-- /dev/null\n");
+	run_shapes(out);
+	fprintf(out, "-- /dev/null, format cache\n");
+	lformat_cache_start();
+	run_shapes(out);
+	lformat_cache_stop();
+	fclose(out);
+	return 0;
+}
@@ -0,0 +1,122 @@
+/* %f/%e/%g: exact formatting vs. nanoprintf's compact approximation and glibc, after checking the exact output against glibc */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "bench.h"
+#define NANOPRINTF_VISIBILITY_STATIC
+#define NANOPRINTF_IMPLEMENTATION
+#undef NANOPRINTF_USE_EXACT_FLOAT_FORMAT_SPECIFIERS
+#define NANOPRINTF_USE_EXACT_FLOAT_FORMAT_SPECIFIERS 1	/* Both engines get compiled, whatever EXACT_FLOAT says */
+#include <nanoprintf.h>
+
+#define CHECK_VALUES 200000
+#define VALUES 1024
+
+/*
+ * '#' with %g is left out: when rounding carries into a new power of ten, glibc drops the zeros
+ * '#' must keep ("%#.3g" of 999.6 gives "1.e+03" rather than "1.00e+03")
+ */
+static const char *check_formats[] = {
+	"%f", "%.0f", "%.1f", "%.3f", "%.10f", "%.20f", "%#.0f", "%12.4f", "%012.3f", "% f", "%.40f",
+	"%e", "%.0e", "%.3e", "%.16e", "%E", "%#.0e", "%-12.3e|", "%.30e",
+	"%g", "%.1g", "%.3g", "%.10g", "%.17g", "%G", "%+g", "%.0g"
+};
+static double values[VALUES];
+
+static uint64_t next_random(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/* Any bit pattern, and values of everyday magnitude with few fraction bits, which hit ties more often */
+static double random_double(uint64_t *s, int i)
+{
+	uint64_t bits = next_random(s);
+	double v;
+
+	if (i & 1)
+		return (double)(int64_t)(bits >> 20) / (double)(1ull << (bits % 40));
+	memcpy(&v, &bits, sizeof(v));
+	return v;
+}
+
+/* Returns the number of mismatches with glibc and of %.17g outputs that don't parse back to the same double */
+static int check()
+{
+	const double special[] = { 0.0, -0.0, 0.5, 2.5, 0.125, 0.1, 1e22, 1e23, 5e-324, 2.2250738585072014e-308, 1.7976931348623157e308, 999999.5, INFINITY, -INFINITY, NAN };
+	char ours[512], theirs[512];
+	uint64_t s = 88172645463325252ull;
+	int failures = 0;
+
+	for (int i = 0; i < CHECK_VALUES + (int)(sizeof(special) / sizeof(*special)); i++) {
+		double v = i < (int)(sizeof(special) / sizeof(*special)) ? special[i] : random_double(&s, i);
+		const char *format = check_formats[i % (sizeof(check_formats) / sizeof(*check_formats))];
+
+		npf_snprintf(ours, sizeof(ours), format, v);
+		snprintf(theirs, sizeof(theirs), format, v);
+		if (strcmp(ours, theirs) && failures++ < 10)
+			printf("mismatch: \"%s\" of %.17g: \"%s\", glibc \"%s\"\n", format, v, ours, theirs);
+		npf_snprintf(ours, sizeof(ours), "%.17g", v);
+		if (isfinite(v) && strtod(ours, NULL) != v && failures++ < 10)
+			printf("no round trip: %.17g printed as \"%s\"\n", v, ours);
+	}
+	return failures;
+}
+
+/* Just the conversion, without parsing the format and copying out the result */
+static int compact(char *buf, const char *format, double v)
+{
+	npf_format_spec_t fs;
+
+	npf_parse_format_spec(format, &fs);
+	return npf_ftoa_rev(buf, &fs, v);
+}
+
+static int exact(char *buf, const char *format, double v)
+{
+	npf_format_spec_t fs;
+
+	npf_parse_format_spec(format, &fs);
+	return npf_ftoa_exact(buf, NANOPRINTF_FLOAT_BUFFER_SIZE, &fs, v);
+}
+
+int main()
+{
+	char buf[512];
+	uint64_t s = 0x9E3779B97F4A7C15ull;
+	int failures = check();
+
+	printf("%d values checked against glibc, %d failures\n", CHECK_VALUES, failures);
+	if (failures)
+		return 1;
+	/* Metrics-like values: a few digits before and after the point */
+	for (int i = 0; i < VALUES; i++)
+		values[i] = (double)(next_random(&s) % 100000000) / 1000.0;
+	BENCH("compact conversion %f", bench_use(compact(buf, "%f", values[_i % VALUES])));
+	BENCH("exact conversion %f", bench_use(exact(buf, "%f", values[_i % VALUES])));
+	BENCH("compact conversion %.3f", bench_use(compact(buf, "%.3f", values[_i % VALUES])));
+	BENCH("exact conversion %.3f", bench_use(exact(buf, "%.3f", values[_i % VALUES])));
+	BENCH("npf_snprintf %f", bench_use(npf_snprintf(buf, sizeof(buf), "%f", values[_i % VALUES])));
+	BENCH("glibc snprintf %f", bench_use(snprintf(buf, sizeof(buf), "%f", values[_i % VALUES])));
+	BENCH("npf_snprintf %e", bench_use(npf_snprintf(buf, sizeof(buf), "%e", values[_i % VALUES])));
+	BENCH("glibc snprintf %e", bench_use(snprintf(buf, sizeof(buf), "%e", values[_i % VALUES])));
+	BENCH("npf_snprintf %g", bench_use(npf_snprintf(buf, sizeof(buf), "%g", values[_i % VALUES])));
+	BENCH("glibc snprintf %g", bench_use(snprintf(buf, sizeof(buf), "%g", values[_i % VALUES])));
+	BENCH("npf_snprintf %.17g", bench_use(npf_snprintf(buf, sizeof(buf), "%.17g", values[_i % VALUES])));
+	BENCH("glibc snprintf %.17g", bench_use(snprintf(buf, sizeof(buf), "%.17g", values[_i % VALUES])));
+	/* The whole exponent range */
+	for (int i = 0; i < VALUES; i++)
+		values[i] = fabs(random_double(&s, 0));
+	for (int i = 0; i < VALUES; i++)
+		if (!isfinite(values[i]))
+			values[i] = 1.0;
+	BENCH("npf_snprintf %e, any exponent", bench_use(npf_snprintf(buf, sizeof(buf), "%e", values[_i % VALUES])));
+	BENCH("glibc snprintf %e, any exponent", bench_use(snprintf(buf, sizeof(buf), "%e", values[_i % VALUES])));
+	BENCH("npf_snprintf %g, any exponent", bench_use(npf_snprintf(buf, sizeof(buf), "%g", values[_i % VALUES])));
+	BENCH("glibc snprintf %g, any exponent", bench_use(snprintf(buf, sizeof(buf), "%g", values[_i % VALUES])));
+	return 0;
+}
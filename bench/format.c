@@ -0,0 +1,180 @@
+/* Two-pass (measure, then format) vs. single-pass formatting, as done by lvfprintf with DYNAMIC_LINE_SIZE, whole lvfprintf calls on both sides of SINGLE_PASS_LINE_SIZE, and parsing vs. precompiled formats */
+#include <log.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bench.h"
+#define NANOPRINTF_VISIBILITY_STATIC
+#define NANOPRINTF_IMPLEMENTATION
+#include <nanoprintf.h>
+
+#define SINGLE_PASS_LINE_SIZE 256	/* Same as src/log.c */
+#define LINE_BUF_SIZE 2048
+
+static int two_pass(const char *format, ...)
+{
+	va_list ap, ptr;
+	int ret;
+
+	va_start(ap, format);
+	va_copy(ptr, ap);
+	ret = npf_vsnprintf(NULL, 0, format, ptr) + 1;
+	va_end(ptr);
+	char buf[ret < LINE_BUF_SIZE ? ret : LINE_BUF_SIZE];
+	ret = npf_vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+	bench_use(buf);
+	return ret;
+}
+
+static int single_pass(const char *format, ...)
+{
+	va_list ap, retry;
+	char buf[SINGLE_PASS_LINE_SIZE];
+	int ret;
+
+	va_start(ap, format);
+	va_copy(retry, ap);
+	ret = npf_vsnprintf(buf, sizeof(buf), format, ap);
+	if (ret > (int)sizeof(buf) - 1) {
+		char big[ret + 1 < LINE_BUF_SIZE ? ret + 1 : LINE_BUF_SIZE];
+		ret = npf_vsnprintf(big, sizeof(big), format, retry);
+		bench_use(big);
+	}
+	va_end(retry);
+	va_end(ap);
+	bench_use(buf);
+	return ret;
+}
+
+typedef struct {
+	char *dst;
+	size_t len, cur;
+} PutcBuffer;
+
+/* One indirect call and bounds check per character, the way npf_vsnprintf used to write */
+static void putc_buffer(int c, void *ctx)
+{
+	PutcBuffer *b = ctx;
+
+	if (b->cur < b->len)
+		b->dst[b->cur++] = (char)c;
+}
+
+static int per_char(const char *format, ...)
+{
+	char buf[LINE_BUF_SIZE];
+	PutcBuffer b = { buf, sizeof(buf) - 1, 0 };
+	va_list ap;
+	int ret;
+
+	va_start(ap, format);
+	ret = npf_vpprintf(putc_buffer, &b, format, ap);
+	va_end(ap);
+	buf[b.cur] = '\0';
+	bench_use(buf);
+	return ret;
+}
+
+static int spans(const char *format, ...)
+{
+	char buf[LINE_BUF_SIZE];
+	va_list ap;
+	int ret;
+
+	va_start(ap, format);
+	ret = npf_vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+	bench_use(buf);
+	return ret;
+}
+
+static int compiled(const npf_compiled_format_t *cf, const char *format, ...)
+{
+	char buf[LINE_BUF_SIZE];
+	va_list ap;
+	int ret;
+
+	va_start(ap, format);
+	ret = npf_vsnprintf_compiled(buf, sizeof(buf), format, cf, ap);
+	va_end(ap);
+	bench_use(buf);
+	return ret;
+}
+
+/* Formats the same arguments both ways, returns 0 if the output matches */
+static int check_compiled(const char *format, ...)
+{
+	char parsed[LINE_BUF_SIZE], precompiled[LINE_BUF_SIZE];
+	npf_compiled_format_t cf;
+	va_list ap;
+	int a, b;
+
+	if (npf_compile_format(format, &cf) < 0)
+		return 0;
+	va_start(ap, format);
+	a = npf_vsnprintf(parsed, sizeof(parsed), format, ap);
+	va_end(ap);
+	va_start(ap, format);
+	b = npf_vsnprintf_compiled(precompiled, sizeof(precompiled), format, &cf, ap);
+	va_end(ap);
+	if (a != b || strcmp(parsed, precompiled)) {
+		printf("MISMATCH %s: \"%s\" vs \"%s\"\n", format, parsed, precompiled);
+		return 1;
+	}
+	return 0;
+}
+
+#define LONG_LITERAL "[INFO]: connection from %s closed after the peer stopped answering keepalive probes, %d requests served, %u bytes sent\n"
+
+int main()
+{
+	static char long_str[1024], over_single_pass[SINGLE_PASS_LINE_SIZE + 64];
+	static npf_compiled_format_t short_cf, integers_cf, literal_cf;
+	int failed = 0, devnull = open("/dev/null", O_WRONLY), saved_stderr = dup(STDERR_FILENO);
+
+	memset(long_str, 'x', sizeof(long_str) - 1);
+	memset(over_single_pass, 'x', sizeof(over_single_pass) - 1);
+	failed |= check_compiled("[INFO]: request %d from %s took %u us\n", 42, "10.0.0.1", 1234u);
+	failed |= check_compiled("%*d|%-*.*s|%%|%05x|%#o|%c%c\n", 6, -42, 8, 3, "abcdef", 0xbeefu, 8u, 'o', 'k');
+	failed |= check_compiled("%.3f %e %g %+d %p\n", 3.14159, 1e-7, 0.0001, 7, (void *)long_str);
+	failed |= check_compiled("100%% done, lone %y stays, tail%", 1);
+	failed |= check_compiled("no specifiers at all\n");
+	if (failed)
+		return 1;
+	npf_compile_format("[INFO]: request %d from %s took %u us\n", &short_cf);
+	npf_compile_format("[INFO]: id=%d seq=%u off=%x len=%d\n", &integers_cf);
+	npf_compile_format(LONG_LITERAL, &literal_cf);
+	BENCH("two-pass short", two_pass("[INFO]: request %d from %s took %u us\n", 42, "10.0.0.1", 1234u));
+	BENCH("single-pass short", single_pass("[INFO]: request %d from %s took %u us\n", 42, "10.0.0.1", 1234u));
+	BENCH("two-pass float", two_pass("[INFO]: load %f, ratio %.3f\n", 0.75, 12.5));
+	BENCH("single-pass float", single_pass("[INFO]: load %f, ratio %.3f\n", 0.75, 12.5));
+	BENCH("two-pass overflow (1023 chars)", two_pass("[INFO]: %s\n", long_str));
+	BENCH("single-pass overflow (1023 chars)", single_pass("[INFO]: %s\n", long_str));
+	BENCH("per-char putc, long literal", per_char(LONG_LITERAL, "10.0.0.1", 42, 123456u));
+	BENCH("spans, long literal", spans(LONG_LITERAL, "10.0.0.1", 42, 123456u));
+	BENCH("per-char putc, %s (1023 chars)", per_char("[INFO]: %s\n", long_str));
+	BENCH("spans, %s (1023 chars)", spans("[INFO]: %s\n", long_str));
+	BENCH("per-char putc, integers", per_char("[INFO]: id=%d seq=%u off=%x len=%d\n", 123456, 7890u, 0x1000u, 512));
+	BENCH("spans, integers", spans("[INFO]: id=%d seq=%u off=%x len=%d\n", 123456, 7890u, 0x1000u, 512));
+	BENCH("parsed, short", spans("[INFO]: request %d from %s took %u us\n", 42, "10.0.0.1", 1234u));
+	BENCH("precompiled, short", compiled(&short_cf, "[INFO]: request %d from %s took %u us\n", 42, "10.0.0.1", 1234u));
+	BENCH("parsed, integers", spans("[INFO]: id=%d seq=%u off=%x len=%d\n", 123456, 7890u, 0x1000u, 512));
+	BENCH("precompiled, integers", compiled(&integers_cf, "[INFO]: id=%d seq=%u off=%x len=%d\n", 123456, 7890u, 0x1000u, 512));
+	BENCH("parsed, long literal", spans(LONG_LITERAL, "10.0.0.1", 42, 123456u));
+	BENCH("precompiled, long literal", compiled(&literal_cf, LONG_LITERAL, "10.0.0.1", 42, 123456u));
+	/* The library's own path: the short line fits the single pass, the long one takes the measured second pass */
+	if (devnull < 0 || saved_stderr < 0) {
+		perror("open");
+		return 1;
+	}
+	setenv("LOG_LEVEL", "INFO", 1);
+	setup_lstdio();
+	fflush(stdout);
+	dup2(devnull, STDERR_FILENO);
+	BENCH("lvfprintf, short line", lfprintf(stderr, "[INFO]: request %d from %s took %u us\n", 42, "10.0.0.1", 1234u));
+	BENCH("lvfprintf, over SINGLE_PASS_LINE_SIZE", lfprintf(stderr, "[INFO]: request %d from %s\n", 42, over_single_pass));
+	dup2(saved_stderr, STDERR_FILENO);
+	return 0;
+}
@@ -0,0 +1,89 @@
+/* Integer to text: the digit-pair and shift conversions nanoprintf uses vs. the one-digit-per-division loop they replaced */
+#include <string.h>
+#include "bench.h"
+#define NANOPRINTF_VISIBILITY_STATIC
+#define NANOPRINTF_IMPLEMENTATION
+#include <nanoprintf.h>
+
+#define VALUES 1024
+
+/* npf_utoa_rev before the specialized paths */
+static __attribute__((noinline)) int reference_utoa_rev(npf_uint_t val, char *buf, uint_fast8_t base, char case_adj)
+{
+	uint_fast8_t n = 0;
+
+	do {
+		int_fast8_t const d = (int_fast8_t)(val % base);
+		*buf++ = (char)(((d < 10) ? '0' : ('A' - 10 + case_adj)) + d);
+		++n;
+		val /= base;
+	} while (val);
+	return (int)n;
+}
+
+static npf_uint_t values[VALUES];
+
+/* Fills values with numbers of digits decimal digits, or 1 to 20 digits with digits == 0 */
+static void fill_values(int digits)
+{
+	uint64_t seed = 0x9E3779B97F4A7C15ull;
+
+	for (int i = 0; i < VALUES; i++) {
+		int d = digits ? digits : 1 + i % 20;
+		npf_uint_t low = 1, v;
+
+		seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+		for (int j = 1; j < d; j++)
+			low *= 10;
+		v = (npf_uint_t)(seed >> 1);
+		values[i] = d == 20 ? low + v % (UINT64_MAX - low) : d == 1 ? v % 10 : low + v % (low * 9);
+	}
+}
+
+/* Both conversions must agree on every value, in every base */
+static int check()
+{
+	const uint_fast8_t bases[] = { 8, 10, 16 };
+	char a[NANOPRINTF_CONVERSION_BUFFER_SIZE], b[NANOPRINTF_CONVERSION_BUFFER_SIZE];
+
+	for (int digits = 0; digits <= 20; digits++) {
+		fill_values(digits);
+		for (int i = 0; i < VALUES; i++) {
+			for (size_t k = 0; k < sizeof(bases); k++) {
+				for (char case_adj = 0; case_adj <= 'a' - 'A'; case_adj += 'a' - 'A') {
+					int la = npf_utoa_rev(values[i], a, bases[k], case_adj);
+					int lb = reference_utoa_rev(values[i], b, bases[k], case_adj);
+
+					if (la != lb || memcmp(a, b, la)) {
+						printf("mismatch: %lu in base %d\n", (unsigned long)values[i], bases[k]);
+						return -1;
+					}
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+int main()
+{
+	const int ranges[] = { 1, 3, 6, 10, 20, 0 };
+	char buf[NANOPRINTF_CONVERSION_BUFFER_SIZE];
+	char name[64];
+
+	if (check() < 0)
+		return 1;
+	for (size_t r = 0; r < sizeof(ranges) / sizeof(*ranges); r++) {
+		fill_values(ranges[r]);
+		if (ranges[r])
+			snprintf(name, sizeof(name), "%d digits", ranges[r]);
+		else
+			snprintf(name, sizeof(name), "mixed 1-20 digits");
+		printf("-- %s\n", name);
+		BENCH("reference base 10", bench_use(reference_utoa_rev(values[_i % VALUES], buf, 10, 0)));
+		BENCH("digit pairs base 10", bench_use(npf_utoa_rev(values[_i % VALUES], buf, 10, 0)));
+		BENCH("reference base 16", bench_use(reference_utoa_rev(values[_i % VALUES], buf, 16, 'a' - 'A')));
+		BENCH("shift base 16", bench_use(npf_utoa_rev(values[_i % VALUES], buf, 16, 'a' - 'A')));
+	}
+	return 0;
+}
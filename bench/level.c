@@ -0,0 +1,16 @@
+/* Cost of a DEBUG message that LOG_LEVEL filters out */
+#include <log.h>
+#include <stdlib.h>
+#include "bench.h"
+
+static volatile int counter;
+
+int main()
+{
+	setenv("LOG_LEVEL", "INFO", 1);
+	setup_lstdio();
+	BENCH("disabled lprintf(\"[DEBUG]: ...\")", lprintf("[DEBUG]: counter %d, %s\n", counter, "x"));
+	BENCH("disabled llprintf(LOG_DEBUG, ...)", llprintf(LOG_DEBUG, "counter %d, %s\n", counter, "x"));
+	BENCH("disabled LOG_DEBUG_F(...)", LOG_DEBUG_F("counter %d, %s\n", counter, "x"));
+	return 0;
+}
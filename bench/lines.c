@@ -0,0 +1,191 @@
+/* Whole logging calls by message shape, sink and thread count, with latency percentiles */
+#include <log.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include "bench.h"
+
+#define TMPFS_PATH "/dev/shm/logging_bench.log"	/* Override with BENCH_TMPFS */
+
+static char long_string[1024];
+static const char *short_strings[] = { "alpha", "beta", "gamma", "delta" };
+
+static void filtered_lprintf(long i)
+{
+	lprintf("[DEBUG]: filtered %d %s\n", (int)i, "x");
+}
+
+static void filtered_llprintf(long i)
+{
+	llprintf(LOG_DEBUG, "filtered %d %s\n", (int)i, "x");
+}
+
+static void short_line(long i)
+{
+	(void)i;
+	lprintf("[INFO]: x\n");
+}
+
+static void long_line(long i)
+{
+	(void)i;
+	lprintf("[INFO]: %s\n", long_string);
+}
+
+static void integer_heavy(long i)
+{
+	lprintf("[INFO]: id=%d seq=%u off=%x len=%d err=%d port=%u\n", (int)i, (unsigned)i * 7, (unsigned)i * 4096, (int)(i & 1023), -(int)(i & 15), 8080u);
+}
+
+static void float_heavy(long i)
+{
+	lprintf("[INFO]: t=%f load=%.3f ratio=%.6f temp=%.1f\n", i * 0.001, i * 1.5, 1.0 / (i + 1), 36.6 + (i & 7));
+}
+
+static void string_heavy(long i)
+{
+	lprintf("[INFO]: user=%s host=%s path=%s method=%s\n", short_strings[i & 3], short_strings[(i + 1) & 3], short_strings[(i + 2) & 3], short_strings[(i + 3) & 3]);
+}
+
+static void error_line(long i)
+{
+	errno = ENOENT;
+	lperrorf("open(%d)", (int)i);
+}
+
+static void error_storm(long i)
+{
+	lprintf("[ERROR]: request %d failed\n", (int)i);
+}
+
+static void level_line(long i)
+{
+	llprintf(LOG_INFO, "request %d done\n", (int)i);
+}
+
+static const struct {
+	const char *name;
+	bench_call call;
+} shapes[] = {
+	{ "short line", short_line },
+	{ "long line (1023 chars)", long_line },
+	{ "integer-heavy", integer_heavy },
+	{ "float-heavy", float_heavy },
+	{ "string-heavy", string_heavy },
+	{ "lperrorf", error_line },
+	{ "llprintf(LOG_INFO)", level_line },
+};
+
+int main()
+{
+	FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+	const char *tmpfs = getenv("BENCH_TMPFS") ? getenv("BENCH_TMPFS") : TMPFS_PATH;
+	const int thread_counts[] = { 1, 4 };
+	int devnull = open("/dev/null", O_WRONLY);
+	LogFormatCacheStats cache_stats;
+	char command[256];
+	FILE *zcat;
+	long lines = 0;
+
+	if (!out || devnull < 0) {
+		perror("open");
+		return 1;
+	}
+	memset(long_string, 'x', sizeof(long_string) - 1);
+	setenv("LOG_LEVEL", "INFO", 1);
+	setup_lstdio();
+	dup2(devnull, STDOUT_FILENO);
+	dup2(devnull, STDERR_FILENO);
+
+	bench_latency_no_lines(out, "filtered lprintf [DEBUG]", 1, filtered_lprintf);
+	bench_latency_no_lines(out, "filtered llprintf(LOG_DEBUG)", 1, filtered_llprintf);
+	fprintf(out, "-- /dev/null\n");
+	for (size_t i = 0; i < sizeof(shapes) / sizeof(*shapes); i++)
+		bench_latency(out, shapes[i].name, 1, shapes[i].call);
+	for (size_t i = 1; i < sizeof(thread_counts) / sizeof(*thread_counts); i++) {
+		bench_latency(out, "short line", thread_counts[i], short_line);
+		bench_latency(out, "integer-heavy", thread_counts[i], integer_heavy);
+	}
+	/* A limit that never runs out, then an error storm that mostly gets dropped */
+	fprintf(out, "-- /dev/null, rate limited\n");
+	lratelimit(LOG_INFO, 1000000000, 1000000000);
+	bench_latency(out, "integer-heavy, under the limit", 1, integer_heavy);
+	lratelimit(LOG_INFO, 0, 0);
+	lratelimit(LOG_ERROR, 1000, 100);
+	bench_latency_no_lines(out, "lprintf [ERROR] storm", 1, error_storm);
+	bench_latency_no_lines(out, "lperrorf storm", 1, error_line);
+	bench_latency_no_lines(out, "lprintf [ERROR] storm", 4, error_storm);
+	fprintf(out, "%lu lines suppressed\n", lratelimit_suppressed());
+	lratelimit(LOG_ERROR, 0, 0);
+	/* Repeats of one line get counted, every new line pays for the hash */
+	fprintf(out, "-- /dev/null, deduplicated\n");
+	ldedup_start(1000);
+	bench_latency_no_lines(out, "short line, repeated", 1, short_line);
+	bench_latency(out, "integer-heavy, never repeated", 1, integer_heavy);
+	bench_latency_no_lines(out, "short line, repeated", 4, short_line);
+	ldedup_stop();
+	/* Formats parsed once, then looked up by address */
+	fprintf(out, "-- /dev/null, format cache\n");
+	lformat_cache_start();
+	bench_latency_no_lines(out, "filtered lprintf [DEBUG]", 1, filtered_lprintf);
+	for (size_t i = 0; i < sizeof(shapes) / sizeof(*shapes); i++)
+		bench_latency(out, shapes[i].name, 1, shapes[i].call);
+	bench_latency(out, "integer-heavy", 4, integer_heavy);
+	lformat_cache_stats(&cache_stats);
+	fprintf(out, "%llu hits, %llu misses, %lu formats\n", cache_stats.hits, cache_stats.misses, cache_stats.formats);
+	lformat_cache_stop();
+
+	for (size_t i = 0; i < sizeof(thread_counts) / sizeof(*thread_counts); i++) {
+		int fd = open(tmpfs, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+		if (fd < 0) {
+			fprintf(out, "-- %s: %s, skipped\n", tmpfs, strerror(errno));
+			break;
+		}
+		if (!i)
+			fprintf(out, "-- %s\n", tmpfs);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+		bench_latency(out, "short line", thread_counts[i], short_line);
+		bench_latency(out, "integer-heavy", thread_counts[i], integer_heavy);
+		bench_latency(out, "long line (1023 chars)", thread_counts[i], long_line);
+		unlink(tmpfs);
+	}
+
+	/* Same file, lines copied into a shared mapping instead of written */
+	for (size_t i = 0; i < sizeof(thread_counts) / sizeof(*thread_counts); i++) {
+		if (lmmap_start(tmpfs, 64 << 20) < 0) {
+			fprintf(out, "-- %s, mapped: %s, skipped\n", tmpfs, strerror(errno));
+			break;
+		}
+		if (!i)
+			fprintf(out, "-- %s, mapped\n", tmpfs);
+		bench_latency(out, "short line", thread_counts[i], short_line);
+		bench_latency(out, "integer-heavy", thread_counts[i], integer_heavy);
+		bench_latency(out, "long line (1023 chars)", thread_counts[i], long_line);
+		lmmap_stop();
+		unlink(tmpfs);
+	}
+
+	/* Buffers far larger than the ring, flushed into gzip members. The file has to stay readable by zcat */
+	fprintf(out, "-- %s, gzip, buffered\n", tmpfs);
+	unlink(tmpfs);
+	redirect_stdio((char *)tmpfs);
+	if (lasync_start(0, LASYNC_BLOCK) < 0 || lasync_compress(6, 65536) < 0 || lbuffer_start(1 << 20, 0) < 0) {
+		fprintf(out, "-- %s, gzip: %s, skipped\n", tmpfs, strerror(errno));
+		return 0;
+	}
+	bench_latency(out, "integer-heavy", 1, integer_heavy);
+	lbuffer_stop();
+	lasync_compress(0, 0);
+	lasync_stop();
+	snprintf(command, sizeof(command), "zcat %s | wc -l", tmpfs);
+	zcat = popen(command, "r");
+	if (!zcat || fscanf(zcat, "%ld", &lines) != 1 || pclose(zcat) || lines != BENCH_LATENCY_ITERATIONS * 2) {
+		fprintf(out, "zcat read %ld lines of %d\n", lines, BENCH_LATENCY_ITERATIONS * 2);
+		return 1;
+	}
+	unlink(tmpfs);
+	return 0;
+}
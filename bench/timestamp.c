@@ -0,0 +1,58 @@
+/* Cost of a minimal line, where building the timestamp prefix dominates everything but the write(2), and of the prefix alone with and without the cache */
+#include <log.h>
+#include <stdbool.h>
+#include <sink.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bench.h"
+
+/* The prefix the way init_line_buffer built it for every line before the cache. gmtime_r stands in for its lock-free localtime_safe */
+static int uncached_prefix(char *buf)
+{
+	time_t now = time(NULL);
+	struct tm tm;
+
+	gmtime_r(&now, &tm);
+	if (!asctime_r(&tm, buf))
+		return 0;
+	buf[24] = ' ';
+	return 25;
+}
+
+/* The same through the library's per-second cache, as every logging call builds it now */
+static int cached_prefix(char *end)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+	return put_line_prefix(end, LOG_INFO, &now);
+}
+
+int main()
+{
+	int saved_stdout = dup(STDOUT_FILENO);
+	int devnull = open("/dev/null", O_WRONLY);
+	uint64_t start, lines = 0;
+	char prefix[LINE_PREFIX_MAX];
+
+	setup_lstdio();
+	BENCH("prefix per call (time, gmtime_r, asctime_r)", bench_use(uncached_prefix(prefix)));
+	BENCH("prefix from the cache (put_line_prefix)", bench_use(cached_prefix(prefix + sizeof(prefix))));
+	dup2(devnull, STDOUT_FILENO);
+	BENCH("lprintf minimal line to /dev/null", lprintf("[INFO]: x\n"));
+	set_timestamp_mode(LOG_TIMESTAMP_ASCTIME_US);
+	BENCH("lprintf minimal line, microseconds", lprintf("[INFO]: x\n"));
+	set_timestamp_mode(LOG_TIMESTAMP_ISO8601_US);
+	BENCH("lprintf minimal line, ISO 8601 microseconds", lprintf("[INFO]: x\n"));
+	set_timestamp_mode(LOG_TIMESTAMP_ASCTIME);
+	/* Keep going for a full second so the prefix rolls over at least once */
+	start = bench_now_ns();
+	while (bench_now_ns() - start < 1000000000) {
+		for (int i = 0; i < 1000; i++)
+			lprintf("[INFO]: x\n");
+		lines += 1000;
+	}
+	dup2(saved_stdout, STDOUT_FILENO);
+	printf("%-48s %10.0f lines/s\n", "lprintf minimal line to /dev/null", lines / ((bench_now_ns() - start) / 1e9));
+	return 0;
+}
@@ -0,0 +1,81 @@
+/* Latency tails of plain write(2) against the io_uring sink, while another thread keeps the same disk busy */
+#include <log.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "bench.h"
+
+#define DISK_PATH "logging_bench_disk.log"	/* On a real disk, not tmpfs. Override with BENCH_DISK */
+#define LOAD_CHUNK (4 << 20)				/* Written and fsync'd over and over by the loader */
+
+static atomic_int loading;
+
+static void short_line(long i)
+{
+	lprintf("[INFO]: request %ld served\n", i);
+}
+
+static void *loader_main(void *arg)
+{
+	const char *path = arg;
+	char *chunk = malloc(LOAD_CHUNK);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (!chunk || fd < 0)
+		return NULL;
+	memset(chunk, 'l', LOAD_CHUNK);
+	while (atomic_load(&loading)) {
+		if (write(fd, chunk, LOAD_CHUNK) < 0 || fsync(fd) < 0)
+			break;
+		if (lseek(fd, 0, SEEK_CUR) > 64 * LOAD_CHUNK)
+			ftruncate(fd, 0);
+	}
+	close(fd);
+	unlink(path);
+	free(chunk);
+	return NULL;
+}
+
+static void run(FILE *out, const char *path, const char *load_path, int loaded)
+{
+	pthread_t loader;
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+	if (fd < 0) {
+		fprintf(out, "-- %s: %s, skipped\n", path, strerror(errno));
+		return;
+	}
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+	if (loaded) {
+		atomic_store(&loading, 1);
+		pthread_create(&loader, NULL, loader_main, (void *)load_path);
+	}
+	bench_latency(out, loaded ? "write(2), disk loaded" : "write(2)", 1, short_line);
+	if (luring_start() < 0)
+		fprintf(out, "io_uring unavailable: %s\n", strerror(errno));
+	else {
+		bench_latency(out, loaded ? "io_uring, disk loaded" : "io_uring", 1, short_line);
+		luring_stop();
+	}
+	if (loaded) {
+		atomic_store(&loading, 0);
+		pthread_join(loader, NULL);
+	}
+	unlink(path);
+}
+
+int main()
+{
+	FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+	const char *path = getenv("BENCH_DISK") ? getenv("BENCH_DISK") : DISK_PATH;
+	char load_path[4096];
+
+	setup_lstdio();
+	snprintf(load_path, sizeof(load_path), "%s.load", path);
+	fprintf(out, "-- %s\n", path);
+	run(out, path, load_path, 0);
+	run(out, path, load_path, 1);
+	return 0;
+}
@@ -0,0 +1,513 @@
+#include <compiler.h>
+#include <log.h>
+#include <sink.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* <Configurable_values without code changes> */
+#define ASYNC_MIN_CAPACITY 4096
+#define ASYNC_BATCH_IOVECS 64		/* Max lines per writev(2) issued by the drainer */
+#define ASYNC_IDLE_TIMEOUT_MS 100	/* Drainer re-checks the ring at least this often even without wakeups */
+#define ASYNC_RENDER_BUFFER 65536	/* Drainer's room for lines rendered from deferred records, per batch */
+/* </Configurable_values> */
+
+/*
+ * Lock-free MPSC byte ring. Producers reserve space by CAS on head, copy their line,
+ * then publish the record by storing its length with the COMMITTED bit set.
+ * The drainer consumes committed records from tail, zeroes them and releases the space.
+ * Records never wrap: if one doesn't fit before the end of the ring, a padding record
+ * (fd == -1) fills the rest and the line goes to offset 0.
+ * DEFERRED records hold a binary log record, which the drainer formats before writing.
+ */
+typedef struct {
+	atomic_uint len;	/* Payload length | COMMITTED | DEFERRED, 0 until published */
+	int fd;
+} Record;
+#define COMMITTED 0x80000000u
+#define DEFERRED 0x40000000u
+#define RECORD_LEN(len)	((len) & ~(COMMITTED | DEFERRED))
+#define RECORD_SIZE(len)	(((sizeof(Record) + (len)) + 7) & ~(size_t)7)
+static_assert(sizeof(Record) == 8, "Records must stay 8-byte aligned");
+static_assert(ASYNC_RENDER_BUFFER >= DEFERRED_LINE_MAX, "ASYNC_RENDER_BUFFER must hold at least one rendered line");
+
+enum {
+	ASYNC_OFF,
+	ASYNC_ON,
+	ASYNC_STOPPING
+};
+
+static char *ring;
+static size_t ring_capacity;		/* Power of two */
+static int full_policy;
+static atomic_size_t head;			/* Next byte to reserve */
+static atomic_size_t tail;			/* Next byte to consume */
+static atomic_int state = ASYNC_OFF;
+static atomic_bool drainer_exit;
+static atomic_int in_flight;		/* Producers that may be touching the ring */
+static atomic_uint drainer_sleeping;	/* Futex word */
+static atomic_uint space_seq;		/* Futex word, bumped whenever the drainer frees space */
+static atomic_int space_waiters;
+static atomic_ulong dropped_lines;
+static pthread_t drainer;
+static pthread_once_t async_once = PTHREAD_ONCE_INIT;
+static int reported_errno;			/* Last write error the drainer reported, 0 after a successful write */
+static char render_buffer[ASYNC_RENDER_BUFFER];	/* Only touched by the drainer */
+static __thread bool is_drainer __attribute__((tls_model("initial-exec")));
+static __thread bool in_enqueue __attribute__((tls_model("initial-exec")));	/* Set while this thread may hold an uncommitted reservation */
+
+/* MT-safe | AS-safe | AC-safe */
+static void futex_wait(atomic_uint *word, unsigned int expected, long timeout_ms)
+{
+	struct timespec ts = { .tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000 };
+
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, &ts, NULL, 0);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static void futex_wake(atomic_uint *word, int count)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static void wake_drainer()
+{
+	if (atomic_load(&drainer_sleeping) && atomic_exchange(&drainer_sleeping, 0))
+		futex_wake(&drainer_sleeping, 1);
+}
+
+/* Returns the offset of the reserved record or -1 when the ring is full */
+/* MT-safe | AS-safe | AC-safe */
+static long reserve(size_t size, size_t *pad)
+{
+	size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+	size_t need;
+
+	do {
+		size_t offset = h & (ring_capacity - 1);
+
+		*pad = (offset + size > ring_capacity) ? ring_capacity - offset : 0;
+		need = *pad + size;
+		if (h + need - atomic_load_explicit(&tail, memory_order_acquire) > ring_capacity)
+			return -1;
+	} while (!atomic_compare_exchange_weak_explicit(&head, &h, h + need, memory_order_relaxed, memory_order_relaxed));
+
+	return h & (ring_capacity - 1);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static long reserve_blocking(size_t size, size_t *pad)
+{
+	long offset;
+
+	while ((offset = reserve(size, pad)) < 0) {
+		unsigned int seq = atomic_load(&space_seq);
+
+		atomic_fetch_add(&space_waiters, 1);
+		wake_drainer();
+		if ((offset = reserve(size, pad)) < 0)
+			futex_wait(&space_seq, seq, ASYNC_IDLE_TIMEOUT_MS);
+		atomic_fetch_sub(&space_waiters, 1);
+		if (offset >= 0 || atomic_load(&state) != ASYNC_ON)
+			break;
+	}
+	return offset;
+}
+
+/* Waits until the drainer consumed everything up to target, or async mode went off */
+/* MT-safe | AS-safe | AC-safe */
+static void wait_tail(size_t target)
+{
+	while ((ptrdiff_t)(atomic_load(&tail) - target) < 0 && atomic_load(&state) != ASYNC_OFF) {
+		unsigned int seq = atomic_load(&space_seq);
+
+		atomic_fetch_add(&space_waiters, 1);
+		wake_drainer();
+		if ((ptrdiff_t)(atomic_load(&tail) - target) < 0)
+			futex_wait(&space_seq, seq, ASYNC_IDLE_TIMEOUT_MS);
+		atomic_fetch_sub(&space_waiters, 1);
+	}
+}
+
+static int enqueue_split(int fd, const struct iovec *iov, int iovcnt, size_t len);
+
+/* MT-safe | AS-safe | AC-safe */
+static int enqueue(int fd, unsigned int flags, const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0, size, pad;
+	Record *rec;
+	long offset;
+	char *dst;
+	bool nested, may_wait;
+
+	if (likely(atomic_load_explicit(&state, memory_order_relaxed) != ASYNC_ON))
+		return -1;
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	size = RECORD_SIZE(len);
+
+	atomic_fetch_add(&in_flight, 1);
+	if (unlikely(atomic_load(&state) != ASYNC_ON)) {
+		atomic_fetch_sub(&in_flight, 1);
+		return -1;
+	}
+	/*
+	 * The drainer can't wait for itself, e.g. when logging from a signal handler on its thread, and
+	 * neither can a signal handler that interrupted its thread's own reservation: the tail never gets past it
+	 */
+	nested = in_enqueue;
+	may_wait = full_policy == LASYNC_BLOCK && !is_drainer && !nested;
+	/* Too large for the ring: written directly, under LASYNC_BLOCK once the lines queued before it are out */
+	if (unlikely(size > ring_capacity / 2)) {
+		size_t target = atomic_load(&head);
+
+		atomic_fetch_sub(&in_flight, 1);
+		/* Written directly it would land uncompressed between gzip members */
+		if (!flags && gzstream_requested(fd))
+			return enqueue_split(fd, iov, iovcnt, len);
+		if (may_wait)
+			wait_tail(target);
+		return -1;
+	}
+
+	in_enqueue = true;
+	offset = may_wait ? reserve_blocking(size, &pad) : reserve(size, &pad);
+	if (offset < 0) {
+		in_enqueue = nested;
+		atomic_fetch_add_explicit(&dropped_lines, 1, memory_order_relaxed);
+		atomic_fetch_sub(&in_flight, 1);
+		return 0;
+	}
+
+	if (pad) {
+		rec = (Record *)(ring + offset);
+		rec->fd = -1;
+		atomic_store_explicit(&rec->len, (pad - sizeof(Record)) | COMMITTED, memory_order_release);
+		offset = 0;
+	}
+	rec = (Record *)(ring + offset);
+	rec->fd = fd;
+	dst = (char *)(rec + 1);
+	for (int i = 0; i < iovcnt; i++) {
+		memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+		dst += iov[i].iov_len;
+	}
+	atomic_store(&rec->len, len | flags | COMMITTED);
+	in_enqueue = nested;
+
+	atomic_fetch_sub(&in_flight, 1);
+	wake_drainer();
+	return len;
+}
+
+/*
+ * Queues len bytes too large for the ring as several records, each cut after the last line that fits,
+ * or inside a line longer than that. If async mode goes off meanwhile, the rest is written directly
+ */
+/* MT-safe | AS-safe | AC-safe */
+static int enqueue_split(int fd, const struct iovec *iov, int iovcnt, size_t len)
+{
+	const size_t limit = ring_capacity / 2 - sizeof(Record) - 7;
+	struct iovec part[iovcnt];
+	size_t done = 0, skip = 0, chunk;
+	int first = 0, n, ret;
+
+	while (done < len) {
+		chunk = 0;
+		n = 0;
+		for (int i = first; i < iovcnt && chunk < limit; i++) {
+			size_t offset = i == first ? skip : 0;
+
+			part[n++] = (struct iovec){ .iov_base = (char *)iov[i].iov_base + offset, .iov_len = min(iov[i].iov_len - offset, limit - chunk) };
+			chunk += part[n - 1].iov_len;
+		}
+		for (int j = n - 1; done + chunk < len && j >= 0; j--) {
+			const char *newline = memrchr(part[j].iov_base, '\n', part[j].iov_len);
+			size_t keep = chunk;
+
+			for (int k = j; k < n; k++)
+				keep -= part[k].iov_len;
+			if (newline) {
+				part[j].iov_len = newline + 1 - (const char *)part[j].iov_base;
+				chunk = keep + part[j].iov_len;
+				n = j + 1;
+				break;
+			}
+		}
+
+		ret = enqueue(fd, 0, part, n);
+		if (ret < 0) {
+			if (!done)
+				return -1;
+			for (int i = first; i < iovcnt; i++) {
+				const char *data = (const char *)iov[i].iov_base + (i == first ? skip : 0);
+				size_t left = iov[i].iov_len - (i == first ? skip : 0);
+
+				while (left) {
+					ssize_t written = write(fd, data, left);
+
+					if (written < 0) {
+						if (errno == EINTR)
+							continue;
+						return done;
+					}
+					rotate_account(fd, written);
+					data += written;
+					left -= written;
+					done += written;
+				}
+			}
+			return done;
+		}
+		done += chunk;
+		while (chunk) {
+			size_t left = iov[first].iov_len - skip;
+
+			if (chunk < left) {
+				skip += chunk;
+				chunk = 0;
+			}
+			else {
+				chunk -= left;
+				first++;
+				skip = 0;
+			}
+		}
+	}
+	return len;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+int async_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	return enqueue(fd, 0, iov, iovcnt);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+int async_write_deferred(int fd, const struct iovec *iov, int iovcnt)
+{
+	return enqueue(fd, DEFERRED, iov, iovcnt);
+}
+
+/*
+ * Single writer per batch, so a partial write can simply be resumed. A full non-blocking fd is
+ * polled until it takes more. On other errors the unwritten lines count as dropped, and the error
+ * is reported once until a write succeeds again, as the report may well go to the failing fd.
+ */
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void write_batch(int fd, struct iovec *iov, int iovcnt)
+{
+	size_t total = 0, written = 0;
+
+	for (int i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+	for (struct iovec *cur = iov; iovcnt && written < total;) {
+		ssize_t ret = writev(fd, cur, min(iovcnt, IOV_MAX));
+
+		if (ret < 0) {
+			struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && poll(&pfd, 1, -1) >= 0)
+				continue;
+			atomic_fetch_add_explicit(&dropped_lines, iovcnt, memory_order_relaxed);
+			if (errno != reported_errno) {
+				reported_errno = errno;
+				dlperror("writev");
+			}
+			break;
+		}
+		reported_errno = 0;
+		written += ret;
+		while (iovcnt && (size_t)ret >= cur->iov_len) {
+			ret -= cur->iov_len;
+			cur++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			cur->iov_base = (char *)cur->iov_base + ret;
+			cur->iov_len -= ret;
+		}
+	}
+	rotate_account(fd, written);
+}
+
+/* Writes out every committed record. Returns false if the ring was empty */
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static bool drain()
+{
+	struct iovec iov[ASYNC_BATCH_IOVECS];
+	size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+	size_t end = t, rendered = 0;
+	int iovcnt = 0, fd = -1;
+	bool drained = false;
+
+	for (;;) {
+		Record *rec = (Record *)(ring + (end & (ring_capacity - 1)));
+		/* A completely full ring would otherwise wrap onto its own first record */
+		unsigned int len = (end - t < ring_capacity) ? atomic_load_explicit(&rec->len, memory_order_acquire) : 0;
+		bool flush = !(len & COMMITTED) || iovcnt == ASYNC_BATCH_IOVECS ||
+			(len & DEFERRED && rendered + DEFERRED_LINE_MAX > ASYNC_RENDER_BUFFER);
+
+		if (!flush && rec->fd != -1 && iovcnt && rec->fd != fd)
+			flush = true;
+		if (flush && iovcnt) {
+			if (mapped_writev(fd, iov, iovcnt) < 0 && gzstream_writev(fd, iov, iovcnt) < 0)
+				write_batch(fd, iov, iovcnt);
+			iovcnt = 0;
+			rendered = 0;
+		}
+		if (flush && end != t) {
+			/* Stale bytes could otherwise look like committed headers on the next lap */
+			size_t from = t & (ring_capacity - 1), to = end & (ring_capacity - 1);
+
+			if (from < to || to == 0)
+				memset(ring + from, 0, (to ? to : ring_capacity) - from);
+			else {
+				memset(ring + from, 0, ring_capacity - from);
+				memset(ring, 0, to);
+			}
+			atomic_store_explicit(&tail, end, memory_order_release);
+			atomic_fetch_add(&space_seq, 1);
+			if (atomic_load(&space_waiters))
+				futex_wake(&space_seq, INT_MAX);
+			t = end;
+			drained = true;
+		}
+		if (!(len & COMMITTED))
+			break;
+		if (rec->fd != -1) {
+			fd = rec->fd;
+			if (len & DEFERRED) {
+				char *line;
+
+				iov[iovcnt].iov_len = binary_render(rec + 1, RECORD_LEN(len), render_buffer + rendered, &line);
+				iov[iovcnt].iov_base = line;
+				rendered = line + iov[iovcnt].iov_len - render_buffer;
+			}
+			else {
+				iov[iovcnt].iov_base = rec + 1;
+				iov[iovcnt].iov_len = RECORD_LEN(len);
+			}
+			iovcnt++;
+		}
+		end += RECORD_SIZE(RECORD_LEN(len));
+	}
+	return drained;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void *drainer_main(void *arg)
+{
+	(void)arg;
+	is_drainer = true;
+	while (!atomic_load(&drainer_exit)) {
+		gzstream_tick(false);
+		if (drain())
+			continue;
+		atomic_store(&drainer_sleeping, 1);
+		if (drain() || atomic_load(&drainer_exit)) {
+			atomic_store(&drainer_sleeping, 0);
+			continue;
+		}
+		futex_wait(&drainer_sleeping, 1, ASYNC_IDLE_TIMEOUT_MS);
+	}
+	/* lasync_stop waited for in-flight producers, so this empties the ring */
+	while (drain());
+	gzstream_tick(true);
+	return NULL;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void stop_at_exit()
+{
+	lasync_stop();
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+static void init_async()
+{
+	atexit(stop_at_exit);
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+int lasync_start(size_t capacity, int policy)
+{
+	size_t size = ASYNC_MIN_CAPACITY;
+	int ret;
+
+	if (atomic_load(&state) != ASYNC_OFF)
+		return -1;
+	pthread_once(&async_once, init_async);
+	while (size < capacity)
+		size <<= 1;
+	ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED) {
+		ring = NULL;
+		dlperror("mmap");
+		return -1;
+	}
+	ring_capacity = size;
+	full_policy = policy;
+	atomic_store(&head, 0);
+	atomic_store(&tail, 0);
+	atomic_store(&drainer_exit, false);
+	atomic_store(&state, ASYNC_ON);
+	ret = pthread_create(&drainer, NULL, drainer_main, NULL);
+	if (ret) {
+		atomic_store(&state, ASYNC_OFF);
+		munmap(ring, size);
+		ring = NULL;
+		errno = ret;
+		dlperror("pthread_create");
+		return -1;
+	}
+	return 0;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+void lasync_flush()
+{
+	if (atomic_load(&state) != ASYNC_ON)
+		return;
+	wait_tail(atomic_load(&head));
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+void lasync_stop()
+{
+	int expected = ASYNC_ON;
+
+	if (!atomic_compare_exchange_strong(&state, &expected, ASYNC_STOPPING))
+		return;
+	while (atomic_load(&in_flight))
+		sched_yield();
+	atomic_store(&drainer_exit, true);
+	atomic_store(&drainer_sleeping, 0);
+	futex_wake(&drainer_sleeping, 1);
+	futex_wake(&space_seq, INT_MAX);
+	pthread_join(drainer, NULL);
+	munmap(ring, ring_capacity);
+	ring = NULL;
+	atomic_store(&state, ASYNC_OFF);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+unsigned long lasync_dropped()
+{
+	return atomic_load_explicit(&dropped_lines, memory_order_relaxed);
+}
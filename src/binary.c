@@ -0,0 +1,219 @@
+#include <compiler.h>
+#include <log.h>
+#include <sink.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#define NANOPRINTF_VISIBILITY_STATIC
+#define NANOPRINTF_IMPLEMENTATION
+#include <nanoprintf.h>
+#include <binlog.h>
+
+/* <Configurable_values without code changes> */
+#define BINARY_ARGS_SIZE 1024		/* Stack room for a call's raw arguments. Long strings get cut to fit */
+#define BINARY_FORMAT_SLOTS 4096	/* Formats remembered with their compiled arguments and whether the stream defined them. Power of two */
+#define BINARY_FORMAT_PROBES 8		/* Formats that find no slot get parsed and defined with every line */
+/* </Configurable_values> */
+
+enum {
+	BINARY_OFF,
+	BINARY_DEFERRED,	/* Records go through the async ring and the drainer formats them */
+	BINARY_STREAM		/* Records go to stream_fd for ldecode */
+};
+
+static atomic_int binary_mode = BINARY_OFF;
+static int stream_fd = -1;
+static atomic_int in_flight;		/* Callers that may still be writing to stream_fd */
+static struct {
+	atomic_uintptr_t format;		/* 0 while free */
+	atomic_bool defined;			/* A BINLOG_FORMAT record is in the stream ahead of anyone who sees this */
+	_Atomic signed char nops;		/* 0 until the claiming caller compiled ops, -1 if the format can't be compiled */
+	uint8_t ops[BINLOG_MAX_OPS];
+} formats[BINARY_FORMAT_SLOTS];
+
+/* Returns format's slot, -1 if the table has no room for it. *claimed tells if this call took the slot */
+/* MT-safe | AS-safe | AC-safe */
+static int find_format(const char *format, bool *claimed)
+{
+	uintptr_t key = (uintptr_t)format;
+	unsigned int hash = (unsigned int)((key * 0x9E3779B97F4A7C15ull) >> 32);
+
+	*claimed = false;
+	for (int i = 0; i < BINARY_FORMAT_PROBES; i++) {
+		int s = (hash + i) & (BINARY_FORMAT_SLOTS - 1);
+		uintptr_t cur = atomic_load_explicit(&formats[s].format, memory_order_acquire);
+
+		if (!cur && atomic_compare_exchange_strong(&formats[s].format, &cur, key)) {
+			*claimed = true;
+			return s;
+		}
+		if (cur == key)
+			return s;
+	}
+	return -1;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static int write_stream(const struct iovec *iov, int iovcnt)
+{
+	int ret = async_writev(stream_fd, iov, iovcnt);
+
+	if (ret < 0) {
+		while ((ret = writev(stream_fd, iov, iovcnt)) < 0 && errno == EINTR);
+	}
+	return ret;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static int write_line_record(const char *format, int slot, const BinlogRecord *line)
+{
+	BinlogRecord definition;
+	struct iovec iov[3];
+	int iovcnt = 0, ret;
+	bool defining = false;
+
+	/* Until some line has taken it into the stream, lines carry their own copy of the definition */
+	if (slot < 0 || !atomic_load_explicit(&formats[slot].defined, memory_order_acquire)) {
+		size_t len = strlen(format) + 1;
+
+		defining = slot >= 0;
+		definition = (BinlogRecord){ .size = sizeof(definition) + len, .type = BINLOG_FORMAT, .format = (uintptr_t)format };
+		iov[iovcnt++] = (struct iovec){ .iov_base = &definition, .iov_len = sizeof(definition) };
+		iov[iovcnt++] = (struct iovec){ .iov_base = (char *)format, .iov_len = len };
+	}
+	iov[iovcnt++] = (struct iovec){ .iov_base = (void *)line, .iov_len = line->size };
+	ret = write_stream(iov, iovcnt);
+	/* Lines dropped by a full async ring took the definition with them, so only one that got through counts */
+	if (defining && ret > 0)
+		atomic_store_explicit(&formats[slot].defined, true, memory_order_release);
+	return ret;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+int binary_vlog(int fd, int level, int tag, const char *format, va_list ap)
+{
+	struct {
+		BinlogRecord header;
+		char args[BINARY_ARGS_SIZE];
+	} rec;
+	struct timespec now;
+	struct iovec iov;
+	va_list args;
+	int mode, len, ret, slot, nops, timestamp_mode, gmtoff;
+	bool claimed;
+
+	if (likely(atomic_load_explicit(&binary_mode, memory_order_relaxed) == BINARY_OFF))
+		return -1;
+	atomic_fetch_add(&in_flight, 1);
+	mode = atomic_load(&binary_mode);
+	if (mode == BINARY_OFF) {
+		atomic_fetch_sub(&in_flight, 1);
+		return -1;
+	}
+
+	slot = find_format(format, &claimed);
+	if (unlikely(claimed)) {
+		nops = binlog_compile(format, formats[slot].ops);
+		atomic_store_explicit(&formats[slot].nops, nops < 0 ? -1 : nops + 1, memory_order_release);
+	}
+	nops = slot < 0 ? -1 : atomic_load_explicit(&formats[slot].nops, memory_order_acquire) - 1;
+	va_copy(args, ap);
+	if (likely(nops >= 0))
+		len = binlog_capture_ops(formats[slot].ops, nops, args, rec.args, sizeof(rec.args));
+	else
+		len = binlog_capture(format, args, rec.args, sizeof(rec.args));
+	va_end(args);
+	if (unlikely(len < 0)) {
+		atomic_fetch_sub(&in_flight, 1);
+		return -1;
+	}
+	/* Same clocks as formatting in place would use, the coarse one being enough without a fraction */
+	timestamp_mode = timestamp_settings(&gmtoff);
+	clock_gettime(TIMESTAMP_HAS_FRACTION(timestamp_mode) ? CLOCK_REALTIME : CLOCK_REALTIME_COARSE, &now);
+	rec.header = (BinlogRecord){
+		.size = sizeof(rec.header) + len,
+		.type = BINLOG_LINE,
+		.level = level,
+		.tag = tag,
+		.fd = fd,
+		.time_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec,
+		.format = (uintptr_t)format
+	};
+
+	if (mode == BINARY_DEFERRED) {
+		iov = (struct iovec){ .iov_base = &rec, .iov_len = rec.header.size };
+		ret = async_write_deferred(fd, &iov, 1);
+	}
+	else
+		ret = write_line_record(format, slot, &rec.header);
+	atomic_fetch_sub(&in_flight, 1);
+	return ret;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+bool binary_enabled()
+{
+	return atomic_load_explicit(&binary_mode, memory_order_relaxed) != BINARY_OFF;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+int binary_render(const void *record, size_t len, char *out, char **start)
+{
+	BinlogRecord header;
+	struct timespec when;
+	char *message = out + LINE_PREFIX_MAX;
+	int message_len;
+
+	memcpy(&header, record, sizeof(header));
+	when.tv_sec = header.time_ns / 1000000000;
+	when.tv_nsec = header.time_ns % 1000000000;
+	message_len = binlog_render((const char *)(uintptr_t)header.format, (const char *)record + sizeof(header),
+		len - sizeof(header), message, DEFERRED_LINE_MAX - LINE_PREFIX_MAX);
+	*start = message - put_line_prefix(message, header.tag, &when);
+	return message + message_len - *start;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+int lbinary_start(int fd)
+{
+	struct {
+		BinlogRecord header;
+		BinlogStart start;
+	} rec = { .header = { .size = sizeof(rec), .type = BINLOG_START }, .start = { .magic = BINLOG_MAGIC } };
+	struct timespec now;
+	struct iovec iov = { .iov_base = &rec, .iov_len = sizeof(rec) };
+	int expected = BINARY_OFF;
+
+	if (fd < 0)
+		return atomic_compare_exchange_strong(&binary_mode, &expected, BINARY_DEFERRED) ? 0 : -1;
+	if (atomic_load(&binary_mode) != BINARY_OFF)
+		return -1;
+
+	/* Addresses may mean other strings in a new stream, e.g. after a library was reloaded */
+	for (int i = 0; i < BINARY_FORMAT_SLOTS; i++) {
+		atomic_store(&formats[i].format, 0);
+		atomic_store(&formats[i].defined, false);
+		atomic_store(&formats[i].nops, 0);
+	}
+	clock_gettime(CLOCK_REALTIME, &now);
+	rec.header.time_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	rec.start.timestamp_mode = timestamp_settings(&rec.start.gmtoff);
+	stream_fd = fd;
+	if (write_stream(&iov, 1) < 0) {
+		dlperror("writev");
+		return -1;
+	}
+	return atomic_compare_exchange_strong(&binary_mode, &expected, BINARY_STREAM) ? 0 : -1;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+void lbinary_stop()
+{
+	if (atomic_exchange(&binary_mode, BINARY_OFF) == BINARY_OFF)
+		return;
+	while (atomic_load(&in_flight))
+		sched_yield();
+}
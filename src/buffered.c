@@ -0,0 +1,335 @@
+#include <compiler.h>
+#include <log.h>
+#include <sink.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+/* <Configurable_values without code changes> */
+#define BUFFERED_FLUSH_LEVEL LOG_ERROR	/* Lines at this level or more severe flush the buffer right away */
+#define BUFFERED_MIN_SIZE 4096
+/* </Configurable_values> */
+
+/*
+ * Every thread that logs gets its own buffer of complete lines. Buffers are never unmapped:
+ * when a thread exits, its buffer is flushed and left for the next new thread to claim,
+ * so exit handlers and the interval flusher can walk the list without locks.
+ * busy is held by whoever touches the contents, the owning thread or a flusher. A flusher only
+ * gives up on a busy buffer when it may have interrupted its holder, i.e. in a signal handler
+ * on a thread that holds a buffer. While lbuffer_stop drains, writers flush their own buffer and
+ * write directly, so no thread's direct writes overtake its buffered lines.
+ */
+typedef struct ThreadBuffer {
+	atomic_int busy;
+	atomic_bool owned;
+	struct ThreadBuffer *next;
+	int fd;						/* Where the buffered lines go. Switching fds flushes first */
+	size_t size;
+	size_t len;
+	uint64_t first_ns;			/* When the oldest buffered line was added */
+	char data[];
+} ThreadBuffer;
+
+static atomic_bool buffering;
+static size_t buffer_size;
+static atomic_ullong flush_interval_ns;
+static _Atomic(ThreadBuffer *) buffers;
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_once = PTHREAD_ONCE_INIT;
+static pthread_t flusher;
+static atomic_bool flusher_running;
+static atomic_bool draining;		/* lbuffer_stop is flushing */
+static atomic_int in_flight;		/* Writers that may not have seen draining yet */
+static atomic_ulong dropped_lines;	/* Lines left unwritten by failed writes */
+static atomic_int reported_errno;	/* Last write error reported, 0 after a successful write */
+static __thread ThreadBuffer *thread_buffer __attribute__((tls_model("initial-exec")));
+static __thread bool in_buffer __attribute__((tls_model("initial-exec")));	/* Set while this thread is inside its own buffer */
+static __thread int holding __attribute__((tls_model("initial-exec")));		/* Other threads' buffers this thread holds busy */
+
+/* MT-safe | AS-safe | AC-safe */
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Caller holds b->busy */
+/* MT-safe | AS-safe | AC-safe */
+static void flush_buffer(ThreadBuffer *b)
+{
+	struct iovec iov = { .iov_base = b->data, .iov_len = b->len };
+	size_t written = 0;
+	int olderrno = errno;
+
+	if (!b->len)
+		return;
+	if (async_writev(b->fd, &iov, 1) < 0) {
+		/* Buffers only ever hold whole lines, so resuming a partial write can't split one between writers */
+		while (written < b->len) {
+			ssize_t ret = write(b->fd, b->data + written, b->len - written);
+
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				if (atomic_exchange(&reported_errno, errno) != errno)
+					dlperror("write");
+				break;
+			}
+			atomic_store_explicit(&reported_errno, 0, memory_order_relaxed);
+			written += ret;
+		}
+		rotate_account(b->fd, written);
+		/* Whatever is left is lost, counted in whole lines since a partial one was cut short */
+		for (const char *p = b->data + written, *end = b->data + b->len; p < end; p++) {
+			p = memchr(p, '\n', end - p);
+			if (!p)
+				break;
+			atomic_fetch_add_explicit(&dropped_lines, 1, memory_order_relaxed);
+		}
+	}
+	b->len = 0;
+	errno = olderrno;
+}
+
+/* Gives up after a few attempts when wait is false, e.g. when flushing from a signal handler */
+/* MT-safe | AS-safe | AC-safe */
+static bool lock_buffer(ThreadBuffer *b, bool wait)
+{
+	int expected, attempts = 0;
+
+	for (;;) {
+		expected = 0;
+		if (atomic_compare_exchange_weak_explicit(&b->busy, &expected, 1, memory_order_acquire, memory_order_relaxed))
+			return true;
+		if (!wait && ++attempts > 100)
+			return false;
+		sched_yield();
+	}
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static void unlock_buffer(ThreadBuffer *b)
+{
+	atomic_store_explicit(&b->busy, 0, memory_order_release);
+}
+
+/* Returns false if a buffer had to be skipped */
+/* MT-safe | AS-safe | AC-safe */
+static bool flush_all(bool wait, bool only_stale)
+{
+	uint64_t now = now_ns(), interval = atomic_load_explicit(&flush_interval_ns, memory_order_relaxed);
+	bool all = true, mine;
+
+	for (ThreadBuffer *b = atomic_load(&buffers); b; b = b->next) {
+		/* This thread's own buffer is mid-update if a signal handler got here */
+		if (b == thread_buffer && in_buffer) {
+			all &= !b->len;
+			continue;
+		}
+		if (!lock_buffer(b, wait)) {
+			all = false;
+			continue;
+		}
+		/* A write error is reported through this thread's own buffer, which must not wait for itself */
+		mine = b == thread_buffer;
+		in_buffer |= mine;
+		holding++;
+		if (!only_stale || (b->len && now - b->first_ns >= interval))
+			flush_buffer(b);
+		unlock_buffer(b);
+		holding--;
+		in_buffer &= !mine;
+	}
+	return all;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void release_thread_buffer(void *arg)
+{
+	ThreadBuffer *b = arg;
+
+	in_buffer = true;
+	lock_buffer(b, true);
+	flush_buffer(b);
+	unlock_buffer(b);
+	thread_buffer = NULL;
+	in_buffer = false;
+	atomic_store(&b->owned, false);
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void flush_at_exit()
+{
+	lflush();
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+static void init_buffering()
+{
+	if (pthread_key_create(&buffer_key, release_thread_buffer))
+		dlperror("pthread_key_create");
+	atexit(flush_at_exit);
+}
+
+/* First use on a thread claims a buffer left behind by an exited thread or maps a new one */
+/* MT-safe | AS-safe | AC-safe */
+static ThreadBuffer *get_thread_buffer()
+{
+	ThreadBuffer *b, *head;
+
+	if (likely(thread_buffer))
+		return thread_buffer;
+	for (b = atomic_load(&buffers); b; b = b->next) {
+		bool expected = false;
+
+		if (b->size == buffer_size && atomic_compare_exchange_strong(&b->owned, &expected, true))
+			break;
+	}
+	if (!b) {
+		b = mmap(NULL, sizeof(ThreadBuffer) + buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (b == MAP_FAILED)
+			return NULL;
+		b->size = buffer_size;
+		atomic_store(&b->owned, true);
+		head = atomic_load(&buffers);
+		do {
+			b->next = head;
+		} while (!atomic_compare_exchange_weak(&buffers, &head, b));
+	}
+	/* Keys below PTHREAD_KEY_2NDLEVEL_SIZE live in the thread descriptor, so this doesn't allocate */
+	pthread_setspecific(buffer_key, b);
+	thread_buffer = b;
+	return b;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+int buffered_writev(int fd, int level, const struct iovec *iov, int iovcnt)
+{
+	ThreadBuffer *b;
+	size_t len = 0;
+	uint64_t now;
+
+	if (likely(!atomic_load_explicit(&buffering, memory_order_relaxed)))
+		return -1;
+	if (in_buffer)
+		return -1;
+	atomic_fetch_add(&in_flight, 1);
+	if (!atomic_load(&buffering) || !(b = get_thread_buffer())) {
+		atomic_fetch_sub(&in_flight, 1);
+		return -1;
+	}
+	in_buffer = true;
+	lock_buffer(b, true);
+	if (unlikely(atomic_load(&draining))) {
+		flush_buffer(b);
+		unlock_buffer(b);
+		in_buffer = false;
+		atomic_fetch_sub(&in_flight, 1);
+		return -1;
+	}
+
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (b->len && (b->fd != fd || b->len + len > b->size))
+		flush_buffer(b);
+	if (len > b->size) {
+		/* Everything before it is out already, so writing it directly keeps the order */
+		unlock_buffer(b);
+		in_buffer = false;
+		atomic_fetch_sub(&in_flight, 1);
+		return -1;
+	}
+
+	now = now_ns();
+	if (!b->len)
+		b->first_ns = now;
+	b->fd = fd;
+	for (int i = 0; i < iovcnt; i++) {
+		memcpy(b->data + b->len, iov[i].iov_base, iov[i].iov_len);
+		b->len += iov[i].iov_len;
+	}
+	if (level <= BUFFERED_FLUSH_LEVEL || now - b->first_ns >= atomic_load_explicit(&flush_interval_ns, memory_order_relaxed))
+		flush_buffer(b);
+
+	unlock_buffer(b);
+	in_buffer = false;
+	atomic_fetch_sub(&in_flight, 1);
+	return len;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void *flusher_main(void *arg)
+{
+	(void)arg;
+	while (atomic_load(&flusher_running)) {
+		uint64_t interval = atomic_load(&flush_interval_ns);
+		struct timespec ts = { .tv_sec = interval / 1000000000, .tv_nsec = interval % 1000000000 };
+
+		nanosleep(&ts, NULL);
+		flush_all(false, true);
+	}
+	return NULL;
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+int lbuffer_start(size_t size, unsigned int flush_interval_ms)
+{
+	int ret;
+
+	if (atomic_load(&buffering))
+		return -1;
+	pthread_once(&buffer_once, init_buffering);
+	buffer_size = max(size, (size_t)BUFFERED_MIN_SIZE);
+	atomic_store(&flush_interval_ns, flush_interval_ms ? (uint64_t)flush_interval_ms * 1000000 : UINT64_MAX);
+	atomic_store(&buffering, true);
+	if (flush_interval_ms) {
+		atomic_store(&flusher_running, true);
+		ret = pthread_create(&flusher, NULL, flusher_main, NULL);
+		if (ret) {
+			atomic_store(&flusher_running, false);
+			errno = ret;
+			dlperror("pthread_create");
+		}
+	}
+	return 0;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+int lflush()
+{
+	/* A signal handler may have interrupted this thread while it held another thread's buffer */
+	if (!flush_all(!holding, false)) {
+		errno = EBUSY;
+		return -1;
+	}
+	return 0;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+unsigned long lbuffer_dropped()
+{
+	return atomic_load_explicit(&dropped_lines, memory_order_relaxed);
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+void lbuffer_stop()
+{
+	if (!atomic_load(&buffering) || atomic_exchange(&draining, true))
+		return;
+	if (atomic_exchange(&flusher_running, false))
+		pthread_join(flusher, NULL);
+	/* Writers that checked draining before this holds their buffer, the rest flush their own */
+	flush_all(true, false);
+	atomic_store(&buffering, false);
+	while (atomic_load(&in_flight))
+		sched_yield();
+	atomic_store(&draining, false);
+}
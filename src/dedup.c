@@ -0,0 +1,138 @@
+#include <compiler.h>
+#include <log.h>
+#include <sink.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* <Configurable_values without code changes> */
+#define DEDUP_MIN_INTERVAL_MS 10
+/* </Configurable_values> */
+
+/*
+ * stdout and stderr each keep their last line as one atomic word: the top bits of a hash of its
+ * format address and formatted message, its level and how often it repeated since. A writer
+ * swaps in its own line with a CAS, or bumps the count if the hash matches and drops the line.
+ * Whoever replaces a line that repeated reports the count first, and a background thread reports
+ * counts that sat there for an interval, so a stream that goes quiet doesn't keep them.
+ */
+#define COUNT_BITS 24
+#define COUNT_MASK ((1ull << COUNT_BITS) - 1)
+#define LEVEL_SHIFT COUNT_BITS
+#define HASH_MASK (~0ull << (COUNT_BITS + 4))
+
+static atomic_bool deduplicating;
+static atomic_ullong last_lines[2];		/* stdout, stderr */
+static atomic_ullong report_interval_ns;
+static pthread_t reporter;
+static atomic_bool reporter_running;
+
+/* MT-safe | AS-safe | AC-safe */
+static uint64_t hash_line(const char *format, const char *message, int len)
+{
+	uint64_t h = (uintptr_t)format * 0x9E3779B97F4A7C15ull ^ len;
+	uint64_t word;
+	int i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&word, message + i, 8);
+		h = (h ^ word) * 0x9E3779B97F4A7C15ull;
+		h ^= h >> 32;
+	}
+	word = 0;
+	memcpy(&word, message + i, len - i);
+	h = (h ^ word) * 0x9E3779B97F4A7C15ull;
+	return h ^ h >> 29;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+long dedup_line(int fd, int level, const char *format, const char *message, int len, int *prev_level)
+{
+	atomic_ullong *last;
+	unsigned long long key, cur, next;
+
+	if (likely(!atomic_load_explicit(&deduplicating, memory_order_relaxed)))
+		return 0;
+	if (fd != STDOUT_FILENO && fd != STDERR_FILENO)
+		return 0;
+	last = &last_lines[fd - STDOUT_FILENO];
+	key = hash_line(format, message, len) & HASH_MASK;
+	cur = atomic_load_explicit(last, memory_order_relaxed);
+	do {
+		if ((cur & HASH_MASK) == key)
+			next = (cur & COUNT_MASK) == COUNT_MASK ? cur : cur + 1;
+		else
+			next = key | (unsigned long long)level << LEVEL_SHIFT;
+	} while (!atomic_compare_exchange_weak_explicit(last, &cur, next, memory_order_relaxed, memory_order_relaxed));
+	if ((cur & HASH_MASK) == key)
+		return -1;
+	*prev_level = (cur >> LEVEL_SHIFT) & 0xf;
+	return cur & COUNT_MASK;
+}
+
+/* Takes the counts the streams collected since their last report */
+/* MT-safe locale | AS-safe | AC-safe */
+static void report_all()
+{
+	for (int i = 0; i < 2; i++) {
+		unsigned long long cur = atomic_load_explicit(&last_lines[i], memory_order_relaxed);
+
+		while (cur & COUNT_MASK) {
+			if (atomic_compare_exchange_weak_explicit(&last_lines[i], &cur, cur & ~COUNT_MASK, memory_order_relaxed, memory_order_relaxed)) {
+				write_repeats(STDOUT_FILENO + i, (cur >> LEVEL_SHIFT) & 0xf, cur & COUNT_MASK);
+				break;
+			}
+		}
+	}
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void *reporter_main(void *arg)
+{
+	(void)arg;
+	while (atomic_load(&reporter_running)) {
+		uint64_t interval = atomic_load(&report_interval_ns);
+		struct timespec ts = { .tv_sec = interval / 1000000000, .tv_nsec = interval % 1000000000 };
+
+		nanosleep(&ts, NULL);
+		report_all();
+	}
+	return NULL;
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+int ldedup_start(unsigned int interval_ms)
+{
+	int ret;
+
+	if (atomic_load(&deduplicating)) {
+		errno = EBUSY;
+		return -1;
+	}
+	atomic_store(&report_interval_ns, (uint64_t)max(interval_ms, (unsigned int)DEDUP_MIN_INTERVAL_MS) * 1000000);
+	atomic_store(&reporter_running, true);
+	ret = pthread_create(&reporter, NULL, reporter_main, NULL);
+	if (ret) {
+		atomic_store(&reporter_running, false);
+		errno = ret;
+		dlperror("pthread_create");
+		return -1;
+	}
+	atomic_store(&deduplicating, true);
+	return 0;
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+void ldedup_stop()
+{
+	if (!atomic_exchange(&deduplicating, false))
+		return;
+	if (atomic_exchange(&reporter_running, false))
+		pthread_join(reporter, NULL);
+	report_all();
+	for (int i = 0; i < 2; i++)
+		atomic_store(&last_lines[i], 0);
+}
@@ -0,0 +1,144 @@
+#include <compiler.h>
+#include <log.h>
+#include <sink.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#define NANOPRINTF_VISIBILITY_STATIC
+#define NANOPRINTF_IMPLEMENTATION
+#include <nanoprintf.h>
+
+/* <Configurable_values without code changes> */
+#define FORMAT_CACHE_SLOTS 1024		/* Formats remembered parsed. Power of two */
+#define FORMAT_CACHE_PROBES 8		/* Formats that find no slot get parsed on every call */
+#define FORMAT_CACHE_HIT_BATCH 256	/* Hits a thread counts on its own before adding them to the total */
+/* </Configurable_values> */
+
+/*
+ * Slots are claimed by format address with a CAS, like binary.c does for its formats. The claiming
+ * caller parses the tag and the specifiers and publishes them with a release store of state, so
+ * everyone who sees state != 0 can read them without further synchronisation. Callers that find
+ * the slot still being filled in, or no slot at all, parse the format themselves. Slots are never
+ * freed, so an entry stays valid for as long as its caller uses it.
+ */
+struct FormatEntry {
+	atomic_uintptr_t format;		/* 0 while free */
+	_Atomic signed char state;		/* 0 until the claiming caller parsed it, -1 if the specifiers can't be compiled, 1 if they were */
+	signed char tag;				/* Level of the format's tag, LOG_NONE without one */
+	npf_compiled_format_t compiled;
+};
+
+static atomic_bool caching;
+static FormatEntry entries[FORMAT_CACHE_SLOTS];
+static atomic_ullong hits;
+static atomic_ullong misses;
+static atomic_ulong taken;
+static __thread unsigned int pending_hits __attribute__((tls_model("initial-exec")));
+
+/* MT-safe | AS-safe | AC-safe */
+static int parse_tag(const char *format)
+{
+	if (format[0] != '[')
+		return LOG_NONE;
+	switch (format[1]) {
+		case 'D':
+			return LOG_DEBUG;
+		case 'I':
+			return LOG_INFO;
+		case 'W':
+			return LOG_WARNING;
+		case 'E':
+			return LOG_ERROR;
+		case 'R':	/* Message from remote peer */
+			return LOG_REMOTE;
+		default:
+			return LOG_NONE;
+	}
+}
+
+/* Returns format's slot, NULL if the table has no room for it. *claimed tells if this call took the slot */
+/* MT-safe | AS-safe | AC-safe */
+static FormatEntry *find_entry(const char *format, bool *claimed)
+{
+	uintptr_t key = (uintptr_t)format;
+	unsigned int hash = (unsigned int)((key * 0x9E3779B97F4A7C15ull) >> 32);
+
+	*claimed = false;
+	for (int i = 0; i < FORMAT_CACHE_PROBES; i++) {
+		FormatEntry *e = &entries[(hash + i) & (FORMAT_CACHE_SLOTS - 1)];
+		uintptr_t cur = atomic_load_explicit(&e->format, memory_order_acquire);
+
+		if (!cur && atomic_compare_exchange_strong(&e->format, &cur, key)) {
+			*claimed = true;
+			return e;
+		}
+		if (cur == key)
+			return e;
+	}
+	return NULL;
+}
+
+/* A signal handler interrupting the update loses at most this thread's pending hits */
+/* MT-safe | AS-safe | AC-safe */
+static void count_hit()
+{
+	if (unlikely(++pending_hits >= FORMAT_CACHE_HIT_BATCH)) {
+		atomic_fetch_add_explicit(&hits, pending_hits, memory_order_relaxed);
+		pending_hits = 0;
+	}
+}
+
+/* MT-safe | AS-safe | AC-safe */
+const FormatEntry *format_lookup(const char *format, int *tag)
+{
+	FormatEntry *e;
+	bool claimed;
+	int state;
+
+	if (likely(!atomic_load_explicit(&caching, memory_order_relaxed))) {
+		*tag = parse_tag(format);
+		return NULL;
+	}
+	e = find_entry(format, &claimed);
+	if (unlikely(claimed)) {
+		e->tag = parse_tag(format);
+		atomic_store_explicit(&e->state, npf_compile_format(format, &e->compiled) < 0 ? -1 : 1, memory_order_release);
+		atomic_fetch_add_explicit(&taken, 1, memory_order_relaxed);
+	}
+	state = e ? atomic_load_explicit(&e->state, memory_order_acquire) : 0;
+	if (likely(state > 0 && !claimed)) {
+		count_hit();
+		*tag = e->tag;
+		return e;
+	}
+	atomic_fetch_add_explicit(&misses, 1, memory_order_relaxed);
+	*tag = state ? e->tag : parse_tag(format);
+	return state > 0 ? e : NULL;
+}
+
+/* MT-safe locale | AS-safe | AC-safe */
+int format_vsnprintf(const FormatEntry *entry, char *buffer, size_t size, const char *format, va_list ap)
+{
+	if (entry)
+		return npf_vsnprintf_compiled(buffer, size, format, &entry->compiled, ap);
+	return npf_vsnprintf(buffer, size, format, ap);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+void lformat_cache_start()
+{
+	atomic_store(&caching, true);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+void lformat_cache_stop()
+{
+	atomic_store(&caching, false);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+void lformat_cache_stats(LogFormatCacheStats *stats)
+{
+	stats->hits = atomic_load(&hits);
+	stats->misses = atomic_load(&misses);
+	stats->formats = atomic_load(&taken);
+}
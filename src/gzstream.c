@@ -0,0 +1,221 @@
+#include <compiler.h>
+#include <log.h>
+#include <sink.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <zlib.h>
+
+/* <Configurable_values without code changes> */
+#define GZSTREAM_FLUSH_MS 1000		/* Longest a line waits in an unfinished member */
+#define GZSTREAM_MIN_FRAME 4096
+/* </Configurable_values> */
+
+/*
+ * stdout and stderr become a series of gzip members, each a complete gzip file of its own:
+ * gunzip reads them as one stream and a file cut short by a crash is readable up to its last
+ * complete member. Members are built in memory and written with a single write(2), and carry
+ * an "LG" extra field with their total size, so readers can skip from member to member without
+ * inflating them (as BGZF does). A member that can't be written whole is cut off the file again,
+ * so the next one never follows a torn member, and its input counts as lost. Only the async drainer touches the stream, lasync_compress
+ * just publishes new settings, which the drainer applies before it writes the next batch.
+ */
+#define GZ_HEADER_SIZE 20			/* Fixed gzip header, XLEN, and the LG subfield with a 32-bit member size */
+#define GZ_TRAILER_SIZE 8			/* CRC32 and input size */
+
+static atomic_uint config_seq;
+static atomic_int requested_level;
+static atomic_size_t requested_frame;
+static unsigned int applied_seq;	/* The rest is only touched by the drainer */
+static int level;					/* 0 while stdio goes out uncompressed */
+static size_t frame_size;			/* Input bytes per member */
+static z_stream zs;
+static unsigned char *member;		/* Header, deflate output and trailer of the member being built */
+static size_t member_capacity;
+static uint32_t crc;
+static uint64_t first_ns;			/* When the member got its first byte */
+static int reported_errno;			/* Last write error reported, 0 after a member got out */
+static atomic_ulong lost_bytes;
+
+/* MT-safe | AS-safe | AC-safe */
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static void put_le32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* MT-Unsafe race:drainer | AS-Unsafe | AC-Unsafe */
+static void reset_member()
+{
+	deflateReset(&zs);
+	zs.next_out = member + GZ_HEADER_SIZE;
+	zs.avail_out = member_capacity - GZ_HEADER_SIZE - GZ_TRAILER_SIZE;
+	crc = crc32(0, NULL, 0);
+}
+
+/* MT-Unsafe race:drainer | AS-Unsafe | AC-Unsafe */
+static void finish_member()
+{
+	static const unsigned char header[GZ_HEADER_SIZE - 4] = {
+		0x1f, 0x8b, Z_DEFLATED, 0x04,	/* Magic, method, FEXTRA */
+		0, 0, 0, 0, 0, 3,				/* No mtime, no extra flags, Unix */
+		8, 0, 'L', 'G', 4, 0			/* XLEN, then the subfield id and length */
+	};
+	size_t len, written = 0;
+	off_t start;
+
+	if (!zs.total_in)
+		return;
+	deflate(&zs, Z_FINISH);
+	len = GZ_HEADER_SIZE + zs.total_out + GZ_TRAILER_SIZE;
+	memcpy(member, header, sizeof(header));
+	put_le32(member + sizeof(header), len);
+	put_le32(member + GZ_HEADER_SIZE + zs.total_out, crc);
+	put_le32(member + GZ_HEADER_SIZE + zs.total_out + 4, zs.total_in);
+	/* stdout and stderr share the redirect_stdio file */
+	start = lseek(STDOUT_FILENO, 0, SEEK_END);
+	while (written < len) {
+		ssize_t ret = write(STDOUT_FILENO, member + written, len - written);
+
+		if (ret < 0) {
+			struct pollfd pfd = { .fd = STDOUT_FILENO, .events = POLLOUT };
+
+			if (errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && poll(&pfd, 1, -1) >= 0))
+				continue;
+			break;
+		}
+		written += ret;
+	}
+	if (unlikely(written < len)) {
+		int err = errno;
+
+		if (written && start >= 0 && !ftruncate(STDOUT_FILENO, start))
+			written = 0;
+		atomic_fetch_add_explicit(&lost_bytes, zs.total_in, memory_order_relaxed);
+		/* Reported once per error, the report itself goes into the next member */
+		if (err != reported_errno) {
+			reported_errno = err;
+			lprintf("[ERROR]: Lost %lu bytes of lines writing a gzip member%s: %s\n", zs.total_in,
+				written ? ", it stays torn" : "", strerrordesc_np(err));
+		}
+	}
+	else
+		reported_errno = 0;
+	rotate_account(STDOUT_FILENO, written);
+	reset_member();
+}
+
+/* MT-Unsafe race:drainer | AS-Unsafe heap | AC-Unsafe mem */
+static void apply_config()
+{
+	applied_seq = atomic_load_explicit(&config_seq, memory_order_acquire);
+	if (level) {
+		finish_member();
+		deflateEnd(&zs);
+		free(member);
+		member = NULL;
+	}
+	level = atomic_load(&requested_level);
+	frame_size = atomic_load(&requested_frame);
+	if (!level)
+		return;
+	zs = (z_stream){ 0 };
+	/* Raw deflate, the gzip framing is written by finish_member */
+	if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		level = 0;
+		return;
+	}
+	member_capacity = GZ_HEADER_SIZE + deflateBound(&zs, frame_size) + GZ_TRAILER_SIZE;
+	member = malloc(member_capacity);
+	if (!member) {
+		deflateEnd(&zs);
+		level = 0;
+		return;
+	}
+	reset_member();
+}
+
+/* MT-safe | AS-safe | AC-safe */
+bool gzstream_requested(int fd)
+{
+	return atomic_load_explicit(&requested_level, memory_order_relaxed) && (fd == STDOUT_FILENO || fd == STDERR_FILENO);
+}
+
+/* MT-Unsafe race:drainer | AS-Unsafe heap | AC-Unsafe mem */
+int gzstream_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	size_t total = 0;
+
+	if (unlikely(atomic_load_explicit(&config_seq, memory_order_acquire) != applied_seq))
+		apply_config();
+	if (likely(!level) || (fd != STDOUT_FILENO && fd != STDERR_FILENO))
+		return -1;
+
+	for (int i = 0; i < iovcnt; i++) {
+		const unsigned char *data = iov[i].iov_base;
+		size_t len = iov[i].iov_len;
+
+		/* Members start on line boundaries unless a single buffer is larger than a frame */
+		if (zs.total_in && zs.total_in + len > frame_size)
+			finish_member();
+		while (len) {
+			size_t chunk = min(len, frame_size - zs.total_in);
+
+			if (!zs.total_in)
+				first_ns = now_ns();
+			zs.next_in = (unsigned char *)data;
+			zs.avail_in = chunk;
+			deflate(&zs, Z_NO_FLUSH);
+			crc = crc32(crc, data, chunk);
+			data += chunk;
+			len -= chunk;
+			if (zs.total_in >= frame_size)
+				finish_member();
+		}
+		total += iov[i].iov_len;
+	}
+	return total;
+}
+
+/* MT-Unsafe race:drainer | AS-Unsafe heap | AC-Unsafe mem */
+void gzstream_tick(bool finish)
+{
+	if (unlikely(atomic_load_explicit(&config_seq, memory_order_acquire) != applied_seq))
+		apply_config();
+	if (level && zs.total_in && (finish || now_ns() - first_ns >= GZSTREAM_FLUSH_MS * 1000000ull))
+		finish_member();
+}
+
+/* MT-safe | AS-safe | AC-safe */
+unsigned long lasync_compress_lost()
+{
+	return atomic_load_explicit(&lost_bytes, memory_order_relaxed);
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+int lasync_compress(int new_level, size_t new_frame_size)
+{
+	if (new_level < 0 || new_level > Z_BEST_COMPRESSION || (new_level && !stdio_path())) {
+		errno = EINVAL;
+		return -1;
+	}
+	atomic_store(&requested_level, new_level);
+	atomic_store(&requested_frame, max(new_frame_size, (size_t)GZSTREAM_MIN_FRAME));
+	atomic_fetch_add_explicit(&config_seq, 1, memory_order_release);
+	return 0;
+}
@@ -0,0 +1,401 @@
+#ifndef _BINLOG_H
+#define _BINLOG_H
+
+/*
+ * Binary log records, shared by the library and the decoder. Not part of the public API.
+ * Include after the nanoprintf implementation: arguments are captured and replayed by walking
+ * the format with npf_parse_format_spec, so both sides agree on what each conversion consumes.
+ *
+ * A stream is a sequence of records, each starting with BinlogRecord:
+ *   BINLOG_START	payload: BinlogStart. Format addresses from earlier records are void after it
+ *   BINLOG_FORMAT	payload: the format string at address format, NULL byte included
+ *   BINLOG_LINE	payload: raw arguments of format, in the order the conversions consume them
+ * Arguments: '*' width/precision, %c and int-sized integers as int32, long-sized integers,
+ * pointers and floating point (as double) as 8 bytes, strings as a uint32 length and the bytes.
+ * Everything is in host byte order and unaligned.
+ */
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+
+#define BINLOG_MAGIC "LOGBIN1"
+
+enum {
+	BINLOG_START = 1,
+	BINLOG_FORMAT,
+	BINLOG_LINE
+};
+
+typedef struct {
+	uint32_t size;		/* Whole record, header included */
+	int32_t fd;			/* Where the line would have gone */
+	uint64_t time_ns;	/* CLOCK_REALTIME */
+	uint64_t format;	/* Address of the format string */
+	uint8_t type;		/* BINLOG_* */
+	uint8_t level;		/* LOG_* the line was logged at, for filtering */
+	uint8_t tag;		/* LOG_* whose tag goes in front of the message, LOG_NONE if the format has it */
+	uint8_t unused[5];	/* Zero, so no padding bytes of the writer's stack end up in the stream */
+} BinlogRecord;
+
+typedef struct {
+	char magic[8];		/* BINLOG_MAGIC */
+	int32_t gmtoff;		/* Writer's offset from UTC in seconds */
+	int32_t timestamp_mode;	/* Writer's LOG_TIMESTAMP_* */
+} BinlogStart;
+
+/* Encodes the arguments format consumes from ap into args. Returns their size, -1 if they don't fit or can't be deferred */
+/* MT-safe | AS-safe | AC-safe */
+static inline int binlog_capture(const char *format, va_list ap, char *args, int size)
+{
+	npf_format_spec_t fs;
+	char *p = args, *end = args + size;
+
+#define BINLOG_PUT(type, value)							\
+	do {												\
+		type _v = (value);								\
+		if (unlikely(end - p < (long)sizeof(_v)))		\
+			return -1;									\
+		memcpy(p, &_v, sizeof(_v));						\
+		p += sizeof(_v);								\
+	} while (0)
+
+	for (const char *cur = format; (cur = strchr(cur, '%'));) {
+		int fs_len = npf_parse_format_spec(cur, &fs);
+
+		if (!fs_len) {
+			cur++;
+			continue;
+		}
+		cur += fs_len;
+		if (fs.field_width_opt == NPF_FMT_SPEC_OPT_STAR)
+			BINLOG_PUT(int32_t, va_arg(ap, int));
+		if (fs.prec_opt == NPF_FMT_SPEC_OPT_STAR)
+			BINLOG_PUT(int32_t, fs.prec = va_arg(ap, int));
+		switch (fs.conv_spec) {
+			case NPF_FMT_SPEC_CONV_PERCENT:
+				break;
+			case NPF_FMT_SPEC_CONV_CHAR:
+				BINLOG_PUT(int32_t, va_arg(ap, int));
+				break;
+			case NPF_FMT_SPEC_CONV_STRING: {
+				const char *s = va_arg(ap, const char *);
+				uint32_t len;
+
+				if (!s)
+					s = "(null)";
+				len = (fs.prec_opt != NPF_FMT_SPEC_OPT_NONE && fs.prec >= 0) ? strnlen(s, fs.prec) : strlen(s);
+				/* Long strings get cut rather than sending the whole line down the slow path */
+				len = min(len, (uint32_t)max(end - p - (long)sizeof(len), 0L));
+				BINLOG_PUT(uint32_t, len);
+				memcpy(p, s, len);
+				p += len;
+			}	break;
+			case NPF_FMT_SPEC_CONV_POINTER:
+				BINLOG_PUT(uint64_t, (uintptr_t)va_arg(ap, void *));
+				break;
+#if NANOPRINTF_USE_FLOAT_FORMAT_SPECIFIERS == 1
+			case NPF_FMT_SPEC_CONV_FLOAT_DEC:
+			case NPF_FMT_SPEC_CONV_FLOAT_SCI:
+			case NPF_FMT_SPEC_CONV_FLOAT_SHORTEST:
+			case NPF_FMT_SPEC_CONV_FLOAT_HEX:
+				if (fs.length_modifier == NPF_FMT_SPEC_LEN_MOD_LONG_DOUBLE)
+					BINLOG_PUT(double, (double)va_arg(ap, long double));
+				else
+					BINLOG_PUT(double, va_arg(ap, double));
+				break;
+#endif
+#if NANOPRINTF_USE_WRITEBACK_FORMAT_SPECIFIERS == 1
+			case NPF_FMT_SPEC_CONV_WRITEBACK:
+				return -1;
+#endif
+			default:	/* Integers */
+				switch (fs.length_modifier) {
+					case NPF_FMT_SPEC_LEN_MOD_LONG:
+						BINLOG_PUT(int64_t, va_arg(ap, long));
+						break;
+#if NANOPRINTF_USE_LARGE_FORMAT_SPECIFIERS == 1
+					case NPF_FMT_SPEC_LEN_MOD_LARGE_LONG_LONG:
+					case NPF_FMT_SPEC_LEN_MOD_LARGE_INTMAX:
+					case NPF_FMT_SPEC_LEN_MOD_LARGE_SIZET:
+					case NPF_FMT_SPEC_LEN_MOD_LARGE_PTRDIFFT:
+						BINLOG_PUT(int64_t, va_arg(ap, long long));
+						break;
+#endif
+					default:
+						BINLOG_PUT(int32_t, va_arg(ap, int));
+				}
+		}
+	}
+#undef BINLOG_PUT
+	return p - args;
+}
+
+/* What a format consumes from its va_list, so hot formats don't get parsed on every call */
+#define BINLOG_MAX_OPS 16
+enum {
+	BINLOG_OP_I32 = 1,	/* int, also '*' and %c */
+	BINLOG_OP_I64,		/* long */
+	BINLOG_OP_F64,		/* double */
+	BINLOG_OP_LDBL,		/* long double, stored as double */
+	BINLOG_OP_PTR,		/* void * */
+	BINLOG_OP_STR		/* char * without precision */
+};
+
+/* Fills ops for format. Returns their count, -1 if format needs binlog_capture (too many arguments, string precision, writeback) */
+/* MT-safe | AS-safe | AC-safe */
+static inline int binlog_compile(const char *format, uint8_t *ops)
+{
+	npf_format_spec_t fs;
+	int n = 0;
+
+	for (const char *cur = format; (cur = strchr(cur, '%'));) {
+		int fs_len = npf_parse_format_spec(cur, &fs);
+		uint8_t op;
+
+		if (!fs_len) {
+			cur++;
+			continue;
+		}
+		cur += fs_len;
+		if (fs.field_width_opt == NPF_FMT_SPEC_OPT_STAR) {
+			if (n == BINLOG_MAX_OPS)
+				return -1;
+			ops[n++] = BINLOG_OP_I32;
+		}
+		if (fs.prec_opt == NPF_FMT_SPEC_OPT_STAR) {
+			if (n == BINLOG_MAX_OPS || fs.conv_spec == NPF_FMT_SPEC_CONV_STRING)
+				return -1;
+			ops[n++] = BINLOG_OP_I32;
+		}
+		switch (fs.conv_spec) {
+			case NPF_FMT_SPEC_CONV_PERCENT:
+				continue;
+			case NPF_FMT_SPEC_CONV_CHAR:
+				op = BINLOG_OP_I32;
+				break;
+			case NPF_FMT_SPEC_CONV_STRING:
+				if (fs.prec_opt != NPF_FMT_SPEC_OPT_NONE)
+					return -1;
+				op = BINLOG_OP_STR;
+				break;
+			case NPF_FMT_SPEC_CONV_POINTER:
+				op = BINLOG_OP_PTR;
+				break;
+#if NANOPRINTF_USE_FLOAT_FORMAT_SPECIFIERS == 1
+			case NPF_FMT_SPEC_CONV_FLOAT_DEC:
+			case NPF_FMT_SPEC_CONV_FLOAT_SCI:
+			case NPF_FMT_SPEC_CONV_FLOAT_SHORTEST:
+			case NPF_FMT_SPEC_CONV_FLOAT_HEX:
+				op = fs.length_modifier == NPF_FMT_SPEC_LEN_MOD_LONG_DOUBLE ? BINLOG_OP_LDBL : BINLOG_OP_F64;
+				break;
+#endif
+#if NANOPRINTF_USE_WRITEBACK_FORMAT_SPECIFIERS == 1
+			case NPF_FMT_SPEC_CONV_WRITEBACK:
+				return -1;
+#endif
+			default:	/* Integers */
+				op = (fs.length_modifier == NPF_FMT_SPEC_LEN_MOD_LONG
+#if NANOPRINTF_USE_LARGE_FORMAT_SPECIFIERS == 1
+					|| fs.length_modifier >= NPF_FMT_SPEC_LEN_MOD_LARGE_LONG_LONG
+#endif
+					) ? BINLOG_OP_I64 : BINLOG_OP_I32;
+		}
+		if (n == BINLOG_MAX_OPS)
+			return -1;
+		ops[n++] = op;
+	}
+	return n;
+}
+
+/* Same as binlog_capture, for a format binlog_compile turned into ops */
+/* MT-safe | AS-safe | AC-safe */
+static inline int binlog_capture_ops(const uint8_t *ops, int nops, va_list ap, char *args, int size)
+{
+	char *p = args, *end = args + size;
+
+	for (int i = 0; i < nops; i++) {
+		union { int32_t i32; int64_t i64; double f64; } v;
+		int len;
+
+		switch (ops[i]) {
+			case BINLOG_OP_STR: {
+				const char *s = va_arg(ap, const char *);
+				uint32_t n;
+
+				if (!s)
+					s = "(null)";
+				n = strlen(s);
+				if (unlikely(end - p < (long)sizeof(n)))
+					return -1;
+				n = min(n, (uint32_t)(end - p - sizeof(n)));
+				memcpy(p, &n, sizeof(n));
+				memcpy(p + sizeof(n), s, n);
+				p += sizeof(n) + n;
+				continue;
+			}
+			case BINLOG_OP_I32:
+				v.i32 = va_arg(ap, int);
+				len = sizeof(v.i32);
+				break;
+			case BINLOG_OP_I64:
+				v.i64 = va_arg(ap, long long);
+				len = sizeof(v.i64);
+				break;
+			case BINLOG_OP_PTR:
+				v.i64 = (uintptr_t)va_arg(ap, void *);
+				len = sizeof(v.i64);
+				break;
+			case BINLOG_OP_LDBL:
+				v.f64 = va_arg(ap, long double);
+				len = sizeof(v.f64);
+				break;
+			default:
+				v.f64 = va_arg(ap, double);
+				len = sizeof(v.f64);
+		}
+		if (unlikely(end - p < len))
+			return -1;
+		memcpy(p, &v, len);
+		p += len;
+	}
+	return p - args;
+}
+
+/* Rebuilds a single conversion with '*' replaced by the captured values. Returns its length */
+/* MT-safe | AS-safe | AC-safe */
+static inline int binlog_spec(const npf_format_spec_t *fs, const char *conv, int width, int prec, char *spec)
+{
+	char *p = spec;
+
+	*p++ = '%';
+	if (fs->left_justified || width < 0)
+		*p++ = '-';
+	else if (fs->leading_zero_pad)
+		*p++ = '0';
+	if (fs->prepend)
+		*p++ = fs->prepend;
+	if (fs->alt_form)
+		*p++ = '#';
+	if (fs->field_width_opt != NPF_FMT_SPEC_OPT_NONE)
+		p += npf_snprintf(p, 12, "%u", width < 0 ? -(unsigned)width : (unsigned)width);
+	if (fs->prec_opt != NPF_FMT_SPEC_OPT_NONE && prec >= 0)
+		p += npf_snprintf(p, 13, ".%u", (unsigned)prec);
+	/* Length modifier and conversion, straight from the format. conv points at the conversion, '%' stops the walk back */
+	const char *mod = conv;
+	while (strchr("hlLjzt", mod[-1]))
+		mod--;
+	while (mod <= conv)
+		*p++ = *mod++;
+	*p = '\0';
+	return p - spec;
+}
+
+/* Formats format with the arguments binlog_capture encoded. Returns the length written, at most size-1 */
+/* MT-safe | AS-safe | AC-safe */
+static inline int binlog_render(const char *format, const char *args, int args_len, char *out, int size)
+{
+	npf_format_spec_t fs;
+	const char *end = args + args_len;
+	char spec[48];
+	int len = 0;
+
+#define BINLOG_GET(type)															\
+	({	type _v = 0;																\
+		if (end - args >= (long)sizeof(_v)) {										\
+			memcpy(&_v, args, sizeof(_v));											\
+			args += sizeof(_v);														\
+		}																			\
+		_v;	})
+#define BINLOG_EMIT(...)															\
+	do {																			\
+		int _n = npf_snprintf(out + len, size - len, __VA_ARGS__);					\
+		len = min(len + max(_n, 0), size - 1);										\
+	} while (0)
+
+	if (size <= 0)
+		return 0;
+	for (const char *cur = format; *cur && len < size - 1;) {
+		const char *literal = cur;
+		int fs_len = 0, width = 0, prec = -1;
+
+		while (*cur && (*cur != '%' || !(fs_len = npf_parse_format_spec(cur, &fs))))
+			cur++;
+		if (cur != literal) {
+			int n = min(cur - literal, (long)(size - 1 - len));
+
+			memcpy(out + len, literal, n);
+			len += n;
+			continue;
+		}
+		if (fs.field_width_opt == NPF_FMT_SPEC_OPT_STAR)
+			width = BINLOG_GET(int32_t);
+		else if (fs.field_width_opt == NPF_FMT_SPEC_OPT_LITERAL)
+			width = fs.field_width;
+		if (fs.prec_opt == NPF_FMT_SPEC_OPT_STAR)
+			prec = BINLOG_GET(int32_t);
+		else if (fs.prec_opt == NPF_FMT_SPEC_OPT_LITERAL)
+			prec = fs.prec;
+		switch (fs.conv_spec) {
+			case NPF_FMT_SPEC_CONV_PERCENT:
+				BINLOG_EMIT("%%");
+				break;
+			case NPF_FMT_SPEC_CONV_CHAR:
+				binlog_spec(&fs, cur + fs_len - 1, width, prec, spec);
+				BINLOG_EMIT(spec, BINLOG_GET(int32_t));
+				break;
+			case NPF_FMT_SPEC_CONV_STRING: {
+				uint32_t n = BINLOG_GET(uint32_t);
+
+				/* Captured bytes aren't NULL-terminated, so the precision bounds them */
+				fs.prec_opt = NPF_FMT_SPEC_OPT_LITERAL;
+				n = min(n, (uint32_t)(end - args));
+				binlog_spec(&fs, cur + fs_len - 1, width, n, spec);
+				BINLOG_EMIT(spec, args);
+				args += n;
+			}	break;
+			case NPF_FMT_SPEC_CONV_POINTER:
+				binlog_spec(&fs, cur + fs_len - 1, width, prec, spec);
+				BINLOG_EMIT(spec, (void *)(uintptr_t)BINLOG_GET(uint64_t));
+				break;
+#if NANOPRINTF_USE_FLOAT_FORMAT_SPECIFIERS == 1
+			case NPF_FMT_SPEC_CONV_FLOAT_DEC:
+			case NPF_FMT_SPEC_CONV_FLOAT_SCI:
+			case NPF_FMT_SPEC_CONV_FLOAT_SHORTEST:
+			case NPF_FMT_SPEC_CONV_FLOAT_HEX: {
+				double value = BINLOG_GET(double);
+
+				binlog_spec(&fs, cur + fs_len - 1, width, prec, spec);
+				if (fs.length_modifier == NPF_FMT_SPEC_LEN_MOD_LONG_DOUBLE)
+					BINLOG_EMIT(spec, (long double)value);
+				else
+					BINLOG_EMIT(spec, value);
+			}	break;
+#endif
+			default:	/* Integers */
+				binlog_spec(&fs, cur + fs_len - 1, width, prec, spec);
+				switch (fs.length_modifier) {
+					case NPF_FMT_SPEC_LEN_MOD_LONG:
+						BINLOG_EMIT(spec, (long)BINLOG_GET(int64_t));
+						break;
+#if NANOPRINTF_USE_LARGE_FORMAT_SPECIFIERS == 1
+					case NPF_FMT_SPEC_LEN_MOD_LARGE_LONG_LONG:
+					case NPF_FMT_SPEC_LEN_MOD_LARGE_INTMAX:
+					case NPF_FMT_SPEC_LEN_MOD_LARGE_SIZET:
+					case NPF_FMT_SPEC_LEN_MOD_LARGE_PTRDIFFT:
+						BINLOG_EMIT(spec, (long long)BINLOG_GET(int64_t));
+						break;
+#endif
+					default:
+						BINLOG_EMIT(spec, (int)BINLOG_GET(int32_t));
+				}
+		}
+		cur += fs_len;
+	}
+#undef BINLOG_GET
+#undef BINLOG_EMIT
+	out[len] = '\0';
+	return len;
+}
+
+#endif /* _BINLOG_H */
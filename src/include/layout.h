@@ -0,0 +1,170 @@
+#ifndef _LAYOUT_H
+#define _LAYOUT_H
+
+/* Text layout of a line: timestamp, tag, message. Shared by the library and ldecode. Not part of the public API. */
+
+#include <compiler.h>
+#include <log.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+static const char *log_tags[] = {
+	[LOG_NONE] = "",
+	[LOG_ERROR] = LOG_ERROR_TAG,
+	[LOG_WARNING] = LOG_WARNING_TAG,
+	[LOG_INFO] = LOG_INFO_TAG,
+	[LOG_DEBUG] = LOG_DEBUG_TAG,
+	[LOG_REMOTE] = LOG_REMOTE_TAG
+};
+static const int log_tag_lengths[] = {	/* Excludes NULL byte */
+	[LOG_NONE] = 0,
+	[LOG_ERROR] = sizeof(LOG_ERROR_TAG) - 1,
+	[LOG_WARNING] = sizeof(LOG_WARNING_TAG) - 1,
+	[LOG_INFO] = sizeof(LOG_INFO_TAG) - 1,
+	[LOG_DEBUG] = sizeof(LOG_DEBUG_TAG) - 1,
+	[LOG_REMOTE] = sizeof(LOG_REMOTE_TAG) - 1
+};
+#define timestamp_size 34	/* Longest prefix: ISO 8601 with microseconds and UTC offset, then a space. Includes NULL byte */
+#define max_tag_size sizeof(LOG_WARNING_TAG)	/* Longest of log_tags. Includes NULL byte */
+#define TIMESTAMP_FRACTION_OFFSET 20	/* Both layouts put the fraction right after "hh:mm:ss." */
+
+/* Simple localtime implementation without locks, taken from https://sourceware.org/bugzilla/show_bug.cgi?id=16145 and slightly adapted */
+/* MT-safe AS-safe AC-safe */
+static inline void localtime_safe(time_t time, long gmtoff, struct tm *tm_time)
+{
+	const char Days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	uint32_t n32_Pass4year;
+	uint32_t n32_hpery;
+
+	tm_time->tm_gmtoff = gmtoff;
+	tm_time->tm_zone = "";
+	tm_time->tm_isdst = -1;
+	if (time < 0)
+		time = 0;
+	time = time + tm_time->tm_gmtoff;
+	tm_time->tm_wday = ((time / 86400) + 4) % 7;
+
+	tm_time->tm_sec = (int)(time % 60);
+	time /= 60;
+	tm_time->tm_min = (int)(time % 60);
+	time /= 60;
+	n32_Pass4year = ((unsigned int)time / (1461L * 24L));
+	tm_time->tm_year = (n32_Pass4year << 2) + 70;
+	time %= 1461L * 24L;
+	for (;;) {
+		n32_hpery = 365 * 24;
+		if ((tm_time->tm_year & 3) == 0)
+			n32_hpery += 24;
+		if (time < n32_hpery)
+			break;
+		tm_time->tm_year++;
+		time -= n32_hpery;
+	}
+	tm_time->tm_hour = (int)(time % 24);
+	time /= 24;
+	tm_time->tm_yday = time;
+	time++;
+	if ((tm_time->tm_year & 3) == 0) {
+		if (time > 60) {
+			time--;
+		}
+		else {
+			if (time == 60) {
+				tm_time->tm_mon = 1;
+				tm_time->tm_mday = 29;
+				return;
+			}
+		}
+	}
+	for (tm_time->tm_mon = 0; Days[tm_time->tm_mon] < time; tm_time->tm_mon++) {
+		time -= Days[tm_time->tm_mon];
+	}
+
+	tm_time->tm_mday = (int)(time);
+	return;
+}
+
+/* Digits after the decimal point for the given LOG_TIMESTAMP_* mode */
+#define TIMESTAMP_PRECISION(mode)	(((mode) % 3) * 3)
+
+static const char weekday_names[7][3] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char month_names[12][3] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+/* MT-safe | AS-safe | AC-safe */
+static inline char *put_digits(char *dst, unsigned int value, int digits)
+{
+	for (int i = digits - 1; i >= 0; i--) {
+		dst[i] = '0' + value % 10;
+		value /= 10;
+	}
+	return dst + digits;
+}
+
+/* Replaces asctime_r, which is several times slower and can't do sub-second precision. Fraction digits are left as zeros. Returns the prefix length */
+/* MT-safe | AS-safe | AC-safe */
+static inline int format_timestamp(time_t rawtime, int mode, long gmtoff, char *line_buffer)
+{
+	struct tm local_time;
+	int precision = TIMESTAMP_PRECISION(mode);
+	char *p = line_buffer;
+
+	localtime_safe(rawtime, gmtoff, &local_time);
+	if (mode >= LOG_TIMESTAMP_ISO8601) {
+		/* 2026-10-16T22:23:34.123+02:00 */
+		p = put_digits(p, min(local_time.tm_year + 1900, 9999), 4);
+		*p++ = '-';
+		p = put_digits(p, local_time.tm_mon + 1, 2);
+		*p++ = '-';
+		p = put_digits(p, local_time.tm_mday, 2);
+		*p++ = 'T';
+	}
+	else {
+		/* Fri Oct 16 22:23:34.123 2026, same as asctime apart from the fraction */
+		memcpy(p, weekday_names[local_time.tm_wday], 3);
+		p[3] = ' ';
+		memcpy(p + 4, month_names[local_time.tm_mon], 3);
+		p[7] = ' ';
+		p[8] = local_time.tm_mday < 10 ? ' ' : '0' + local_time.tm_mday / 10;
+		p[9] = '0' + local_time.tm_mday % 10;
+		p[10] = ' ';
+		p += 11;
+	}
+	p = put_digits(p, local_time.tm_hour, 2);
+	*p++ = ':';
+	p = put_digits(p, local_time.tm_min, 2);
+	*p++ = ':';
+	p = put_digits(p, local_time.tm_sec, 2);
+	if (precision) {
+		*p++ = '.';
+		p = put_digits(p, 0, precision);
+	}
+	if (mode >= LOG_TIMESTAMP_ISO8601) {
+		long offset = local_time.tm_gmtoff / 60;
+
+		*p++ = offset < 0 ? '-' : '+';
+		offset = offset < 0 ? -offset : offset;
+		p = put_digits(p, offset / 60, 2);
+		*p++ = ':';
+		p = put_digits(p, offset % 60, 2);
+	}
+	else {
+		*p++ = ' ';
+		p = put_digits(p, min(local_time.tm_year + 1900, 9999), 4);
+	}
+	*p++ = ' ';
+	*p = '\0';
+	return p - line_buffer;
+}
+
+/* Fills in the fraction digits of a timestamp formatted by format_timestamp */
+/* MT-safe | AS-safe | AC-safe */
+static inline void put_timestamp_fraction(char *timestamp, int mode, long nsec)
+{
+	if (TIMESTAMP_PRECISION(mode) == 3)
+		put_digits(timestamp + TIMESTAMP_FRACTION_OFFSET, nsec / 1000000, 3);
+	else if (TIMESTAMP_PRECISION(mode) == 6)
+		put_digits(timestamp + TIMESTAMP_FRACTION_OFFSET, nsec / 1000, 6);
+}
+
+#endif /* _LAYOUT_H */
@@ -5,6 +5,10 @@
 #include <errno.h>
 #include <stdarg.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define LOG_NONE	0
 #define LOG_ERROR	1
 #define LOG_WARNING	2
@@ -18,6 +22,13 @@
 #define LOG_DEBUG_TAG   "[DEBUG]: "
 #define LOG_REMOTE_TAG  "[REMOTE]: "
 
+#define LOG_TIMESTAMP_ASCTIME		0	/* Fri Oct 16 22:23:34 2026 */
+#define LOG_TIMESTAMP_ASCTIME_MS	1	/* Fri Oct 16 22:23:34.123 2026 */
+#define LOG_TIMESTAMP_ASCTIME_US	2	/* Fri Oct 16 22:23:34.123456 2026 */
+#define LOG_TIMESTAMP_ISO8601		3	/* 2026-10-16T22:23:34+02:00 */
+#define LOG_TIMESTAMP_ISO8601_MS	4	/* 2026-10-16T22:23:34.123+02:00 */
+#define LOG_TIMESTAMP_ISO8601_US	5	/* 2026-10-16T22:23:34.123456+02:00 */
+
 #define LOG_TAG_SIZE(level)								\
     ((level) == LOG_ERROR ? sizeof(LOG_ERROR_TAG) :		\
     (level) == LOG_WARNING ? sizeof(LOG_WARNING_TAG) :	\
@@ -25,20 +36,260 @@
     (level) == LOG_DEBUG ? sizeof(LOG_DEBUG_TAG) :		\
     (level) == LOG_REMOTE ? sizeof(LOG_REMOTE_TAG) : 0)
 
+#define LOG_LINE_HEADROOM	64	/* Bytes lline_write may use in front of a message for its timestamp and tag */
+
+#define LASYNC_DROP		0	/* lasync_start policy: drop lines while the ring is full */
+#define LASYNC_BLOCK	1	/* lasync_start policy: wait for the drainer while the ring is full */
+
+extern int _log_level;	/* Read through get_log_level() */
+
+/* MT-safe | AS-safe | AC-safe */
+static inline int get_log_level()
+{
+	return __atomic_load_n(&_log_level, __ATOMIC_RELAXED);
+}
+
+/* One relaxed load and a compare, meant to guard calls at the call site */
+/* MT-safe | AS-safe | AC-safe */
+static inline int log_enabled(int level)
+{
+	return level == LOG_REMOTE || get_log_level() >= level;
+}
+
+/* level is one of LOG_NONE..LOG_DEBUG */
+/* MT-safe | AS-safe | AC-safe */
+void set_log_level(int level);
+
+/* Install handlers: cycle_signum steps NONE -> ERROR -> ... -> DEBUG -> NONE, reload_signum restores LOG_LEVEL. 0 skips one */
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+int setup_log_level_signals(int cycle_signum, int reload_signum);
+
 void redirect_stdio(char *log_path);
 
+/*
+ * Rotate the file redirect_stdio opened once it grows past size bytes and/or every interval_s seconds,
+ * counted from local midnight, where intervals that don't divide a day start over.
+ * Old files are kept as log_path.1 (newest) to log_path.keep, 0 disables a trigger.
+ * A background thread renames and reopens the file, logging calls never wait for it
+ */
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+int lrotate_start(size_t size, unsigned int interval_s, unsigned int keep);
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+void lrotate_stop();
+
+/* Totals over the rotated files lrotate_compress finished */
+typedef struct {
+	unsigned long files;
+	unsigned long long bytes_in;
+	unsigned long long bytes_out;	/* bytes_in / bytes_out is the compression ratio */
+	unsigned long long cpu_ns;		/* CPU time the compressing thread spent */
+	unsigned long long wall_ns;		/* Time from opening to renaming the files, throttling included */
+} LogCompressStats;
+
+/* Gzip rotated generations to log_path.N.gz at level 1-9 in an idle-priority, throttled thread. 0 stops it */
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+int lrotate_compress(int level);
+
+/* MT-safe | AS-safe | AC-safe */
+void lrotate_compress_stats(LogCompressStats *stats);
+
+/* Have the next logging call (or the lrotate_start thread) reopen the redirect_stdio file, e.g. after an external rename */
+/* MT-safe | AS-safe | AC-safe */
+void lreopen();
+
+/* Install a handler that calls lreopen() on signum, typically SIGHUP */
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+int setup_reopen_signal(int signum);
+
+/*
+ * Let each call site (format string) at level, one of LOG_ERROR..LOG_DEBUG, print up to rate lines per second,
+ * after an initial burst of up to burst lines. Excess lines are dropped, and about once a second a logging call
+ * at a limited level reports how many lines each call site lost. rate 0 lifts the limit
+ */
+/* MT-safe | AS-safe | AC-safe */
+int lratelimit(int level, unsigned int rate, unsigned int burst);
+
+/* Lines dropped by lratelimit so far */
+/* MT-safe | AS-safe | AC-safe */
+unsigned long lratelimit_suppressed();
+
+/*
+ * Drop lines that repeat the previous line of stdout or stderr (same format, same formatted message) and
+ * report them as one "Last line repeated N times" line, written before the next different line, or by a
+ * background thread every interval_ms. Lines recorded by lbinary_start aren't compared
+ */
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+int ldedup_start(unsigned int interval_ms);
+
+/* Report pending repeats and stop comparing lines */
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+void ldedup_stop();
+
+/*
+ * Remember each format, told apart by its address, with its tag and specifiers parsed, so later calls
+ * with it skip parsing. Formats stay remembered for the life of the process: while the cache is on,
+ * they must be string literals (or otherwise never change) of code that doesn't get unloaded
+ */
+/* MT-safe | AS-safe | AC-safe */
+void lformat_cache_start();
+
+/* Back to parsing every format. Remembered formats are kept for the next lformat_cache_start */
+/* MT-safe | AS-safe | AC-safe */
+void lformat_cache_stop();
+
+typedef struct {
+	unsigned long long hits;	/* Calls that found their format parsed. Each thread adds them up 256 at a time */
+	unsigned long long misses;	/* Calls that parsed their format: first calls, and formats with no slot or too many specifiers */
+	unsigned long formats;		/* Formats remembered */
+} LogFormatCacheStats;
+
+/* MT-safe | AS-safe | AC-safe */
+void lformat_cache_stats(LogFormatCacheStats *stats);
+
+/* Queue lines into a lock-free ring of at least capacity bytes, drained by a background thread */
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+int lasync_start(size_t capacity, int policy);
+
+/* Wait until everything queued before the call has been written */
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+void lasync_flush();
+
+/* Drain the ring and return to synchronous writes */
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+void lasync_stop();
+
+/* MT-safe | AS-safe | AC-safe */
+unsigned long lasync_dropped();
+
+/*
+ * Have the drainer write stdout and stderr, redirected to a file, as independent gzip members of
+ * frame_size input bytes, so a file cut short stays readable up to its last complete member.
+ * Lines wait up to a second in an unfinished member. Only lines that go through the drainer get
+ * compressed, so it's meant to run between lasync_start and lasync_stop. level 1-9, 0 stops
+ */
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+int lasync_compress(int level, size_t frame_size);
+
+/* Bytes of lines lost to members that couldn't be written, reported once per error */
+/* MT-safe | AS-safe | AC-safe */
+unsigned long lasync_compress_lost();
+
+/*
+ * Submit lines to io_uring instead of calling write(2), so a slow disk doesn't stall the caller.
+ * A background thread reaps completions. Fails if io_uring is unavailable, lines then keep being written directly
+ */
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+int luring_start();
+
+/* Wait for submitted lines and go back to write(2) */
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+void luring_stop();
+
+/*
+ * Record calls as format address, timestamp and raw arguments instead of formatting them.
+ * fd >= 0 gets a binary stream for ldecode, fd == -1 has the async drainer format the records,
+ * so calls keep being formatted in place until lasync_start. Format strings must stay mapped
+ */
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+int lbinary_start(int fd);
+
+/* Back to formatting in place. Doesn't close the fd */
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+void lbinary_stop();
+
+/*
+ * Copy lines for stdout and stderr into a shared mapping of path, preallocated extent_size bytes at a time,
+ * instead of writing them. Appends after the last complete line of an existing file. lmmap_stop, or exit(),
+ * truncates the preallocated tail; after a crash, runs of NUL bytes mark lines that were never fully copied
+ */
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+int lmmap_start(const char *path, size_t extent_size);
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+void lmmap_stop();
+
+/* Lines lost because the file couldn't grow */
+/* MT-safe | AS-safe | AC-safe */
+unsigned long lmmap_dropped();
+
+/*
+ * Collect each thread's lines in a private buffer of size bytes, written out when it fills up,
+ * when a LOG_ERROR line arrives, when the thread exits, at exit() and on lflush().
+ * A nonzero flush_interval_ms also bounds how long a line may wait, checked by a background thread
+ */
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+int lbuffer_start(size_t size, unsigned int flush_interval_ms);
+
+/*
+ * Write out every thread's buffered lines, waiting for buffers another thread is using. Returns -1 (EBUSY)
+ * if some were left, which only happens in a signal handler that interrupted this thread's logging or flushing
+ */
+/* MT-safe | AS-safe | AC-safe */
+int lflush();
+
+/* Flush all buffers and return to unbuffered writes */
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem */
+void lbuffer_stop();
+
+/* Lines lost to failed writes of a buffer */
+/* MT-safe | AS-safe | AC-safe */
+unsigned long lbuffer_dropped();
+
 /* MT-Safe env locale | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
 void update_timezone();
 
 /* MT-Safe env locale | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
 void setup_lstdio();
 
+/* mode is one of LOG_TIMESTAMP_* */
+/* MT-safe | AS-safe | AC-safe */
+void set_timestamp_mode(int mode);
+
 /* Applies to all below: MT-safe locale | AS-safe | AC-safe */
 int lfprintf(FILE *stream, const char *format, ...);
 int lprintf(const char *format, ...);
 int lvfprintf(FILE *stream, const char *format, va_list ap);
 void lperrorf(const char *format, ...);
+/* level is one of LOG_ERROR..LOG_REMOTE and its tag gets added, so format must not start with one */
+int llprintf(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+int lvlfprintf(FILE *stream, int level, const char *format, va_list ap);
 #define lperror(message)	lprintf("[ERROR]: %s: %s\n", message, strerrordesc_np(errno))
 #define dlperror(message)	lprintf("[ERROR]: %s:"TOSTRING(__LINE__)": %s: %s\n", basename(__FILE__), message, strerrordesc_np(errno))
 
+/*
+ * For front ends that format lines themselves, like log.hpp. level is the line's level, LOG_NONE for an untagged
+ * lprintf line. lline_begin applies the level filter and the rate limit, and returns 1 if the line should be formatted
+ * and passed to lline_write, 0 if it's dropped, and -1 if it has to go through lline_printf instead, because binary mode
+ * records arguments rather than text. tag is the level whose tag gets added, LOG_NONE if format starts with its own
+ */
+int lline_begin(int level, const char *format);
+/* message has LOG_LINE_HEADROOM writable bytes in front of it and size bytes from it, len is the formatted length */
+int lline_write(FILE *stream, int level, int tag, const char *format, char *message, int size, int len);
+int lline_printf(FILE *stream, int level, int tag, const char *format, ...);
+
+/*
+ * Level-specific front end. Messages above LOG_COMPILE_LEVEL compile to nothing (arguments included),
+ * messages filtered out at runtime cost a load and a branch without evaluating the arguments,
+ * and the rest skip parsing the tag out of the format string. Format has no tag:
+ * LOG_INFO_F("Listening on %s\n", addr);
+ */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL	LOG_DEBUG
+#endif
+#define _LOG_F(level, format, ...)							\
+	do {													\
+		if ((level) <= LOG_COMPILE_LEVEL && log_enabled(level))	\
+			llprintf(level, format, ##__VA_ARGS__);		\
+	} while (0)
+#define LOG_ERROR_F(format, ...)	_LOG_F(LOG_ERROR, format, ##__VA_ARGS__)
+#define LOG_WARNING_F(format, ...)	_LOG_F(LOG_WARNING, format, ##__VA_ARGS__)
+#define LOG_INFO_F(format, ...)		_LOG_F(LOG_INFO, format, ##__VA_ARGS__)
+#define LOG_DEBUG_F(format, ...)	_LOG_F(LOG_DEBUG, format, ##__VA_ARGS__)
+#define LOG_REMOTE_F(format, ...)	llprintf(LOG_REMOTE, format, ##__VA_ARGS__)
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _LOG_H */
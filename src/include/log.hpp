@@ -0,0 +1,431 @@
+#ifndef _LOG_HPP
+#define _LOG_HPP
+
+/*
+ * Header-only C++20 front end. Formats and their level tags are parsed at compile time, every argument is
+ * checked against its conversion, and each call site gets a formatter of its own that writes into the same
+ * line buffer, through the same sinks, as lprintf. AS-safe, no allocation. Formats must be string literals:
+ *
+ *   logging::print<"[INFO]: listening on %s:%u\n">(host, port);	like lprintf
+ *   logging::info<"listening on %s:%u\n">(host, port);				like LOG_INFO_F
+ *
+ * '*' widths and precisions and %n aren't supported. %s takes char pointers and std::string
+ */
+
+#if !defined(__cplusplus) || __cplusplus < 202002L
+#error "log.hpp needs C++20"
+#endif
+
+#include <log.h>
+#include <cstddef>
+#include <cstring>
+#include <array>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/* Same float output as the library's default build (EXACT_FLOAT = 1 in the Makefile) */
+#ifndef NANOPRINTF_USE_EXACT_FLOAT_FORMAT_SPECIFIERS
+#define NANOPRINTF_USE_EXACT_FLOAT_FORMAT_SPECIFIERS 1
+#endif
+#ifndef NANOPRINTF_VISIBILITY_STATIC
+#define NANOPRINTF_VISIBILITY_STATIC
+#endif
+#ifndef NANOPRINTF_IMPLEMENTATION
+#define NANOPRINTF_IMPLEMENTATION
+#endif
+#include <nanoprintf.h>
+
+/* <Configurable_values without code changes> */
+#define LOG_CXX_SINGLE_PASS_SIZE 256	/* Message bytes formatted on the stack first, like SINGLE_PASS_LINE_SIZE */
+#define LOG_CXX_LINE_SIZE 2048			/* Message bytes for lines that didn't fit, longer ones get cut */
+/* </Configurable_values> */
+
+namespace logging {
+
+/* A format string as a template argument */
+template <std::size_t N>
+struct Format {
+	char text[N];
+
+	consteval Format(const char (&s)[N])
+	{
+		for (std::size_t i = 0; i < N; i++)
+			text[i] = s[i];
+	}
+};
+
+namespace detail {
+
+/* The literal run in front of a specifier and the specifier, the last one being the literal tail (spec_len 0) */
+struct Spec {
+	std::size_t literal;
+	std::size_t literal_len;
+	int spec_len;
+	int arg;					/* Index of the argument it takes, -1 for %% */
+	npf_format_spec_t fs;
+};
+
+/* Same tags as lprintf recognizes */
+consteval int parse_tag(const char *format)
+{
+	if (format[0] != '[')
+		return LOG_NONE;
+	switch (format[1]) {
+		case 'D':
+			return LOG_DEBUG;
+		case 'I':
+			return LOG_INFO;
+		case 'W':
+			return LOG_WARNING;
+		case 'E':
+			return LOG_ERROR;
+		case 'R':
+			return LOG_REMOTE;
+		default:
+			return LOG_NONE;
+	}
+}
+
+/* Splits format the way npf_compile_format does. Returns the number of specifiers, stores them if specs isn't NULL */
+constexpr std::size_t split(const char *format, Spec *specs)
+{
+	std::size_t cur = 0, literal = 0, count = 0;
+	int args = 0;
+
+	for (;;) {
+		npf_format_spec_t fs{};
+		int fs_len;
+
+		while (format[cur] && format[cur] != '%')
+			cur++;
+		fs_len = format[cur] ? npf_parse_format_spec(format + cur, &fs) : 0;
+		if (format[cur] && !fs_len) {		/* Printed as is */
+			cur++;
+			continue;
+		}
+		if (specs) {
+			bool takes_arg = fs_len && fs.conv_spec != NPF_FMT_SPEC_CONV_PERCENT;
+
+			specs[count] = Spec{ literal, cur - literal, fs_len, takes_arg ? args++ : -1, fs };
+		}
+		if (!fs_len)
+			return count;
+		count++;
+		cur += fs_len;
+		literal = cur;
+	}
+}
+
+template <Format F>
+struct Parsed {
+	static constexpr int tag = parse_tag(F.text);
+	static constexpr std::size_t count = split(F.text, nullptr);
+	static constexpr std::array<Spec, count + 1> specs = [] {
+		std::array<Spec, count + 1> s{};
+
+		split(F.text, s.data());
+		return s;
+	}();
+	static constexpr int args = [] {
+		int n = 0;
+
+		for (const Spec &s : specs)
+			n += s.arg >= 0;
+		return n;
+	}();
+	static constexpr bool star = [] {
+		for (const Spec &s : specs) {
+#if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
+			if (s.fs.field_width_opt == NPF_FMT_SPEC_OPT_STAR)
+				return true;
+#endif
+#if NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 1
+			if (s.fs.prec_opt == NPF_FMT_SPEC_OPT_STAR)
+				return true;
+#endif
+		}
+		return false;
+	}();
+	/* Spec index of each argument */
+	static constexpr std::array<std::size_t, args> arg_specs = [] {
+		std::array<std::size_t, args> a{};
+
+		for (std::size_t i = 0; i < count; i++) {
+			if (specs[i].arg >= 0)
+				a[specs[i].arg] = i;
+		}
+		return a;
+	}();
+};
+
+template <class T>
+inline constexpr bool is_string = std::is_same_v<std::decay_t<T>, char *> || std::is_same_v<std::decay_t<T>, const char *> ||
+	std::is_same_v<std::remove_cvref_t<T>, std::string>;
+
+consteval bool is_float_conv(const npf_format_spec_t &fs)
+{
+#if NANOPRINTF_USE_FLOAT_FORMAT_SPECIFIERS == 1
+	return fs.conv_spec == NPF_FMT_SPEC_CONV_FLOAT_DEC || fs.conv_spec == NPF_FMT_SPEC_CONV_FLOAT_SCI ||
+		fs.conv_spec == NPF_FMT_SPEC_CONV_FLOAT_SHORTEST || fs.conv_spec == NPF_FMT_SPEC_CONV_FLOAT_HEX;
+#else
+	return (void)fs, false;
+#endif
+}
+
+/* Size of the integer an integer conversion reads with its length modifier */
+consteval std::size_t int_size(int length_modifier)
+{
+	switch (length_modifier) {
+		case NPF_FMT_SPEC_LEN_MOD_LONG:
+			return sizeof(long);
+#if NANOPRINTF_USE_LARGE_FORMAT_SPECIFIERS == 1
+		case NPF_FMT_SPEC_LEN_MOD_LARGE_LONG_LONG:
+			return sizeof(long long);
+		case NPF_FMT_SPEC_LEN_MOD_LARGE_INTMAX:
+			return sizeof(intmax_t);
+		case NPF_FMT_SPEC_LEN_MOD_LARGE_SIZET:
+			return sizeof(size_t);
+		case NPF_FMT_SPEC_LEN_MOD_LARGE_PTRDIFFT:
+			return sizeof(ptrdiff_t);
+#endif
+		default:
+			return sizeof(int);
+	}
+}
+
+/* Fails to compile if an argument of type T doesn't fit specs[I]'s conversion */
+template <Format F, std::size_t I, class T>
+consteval void check_arg()
+{
+	constexpr npf_format_spec_t fs = Parsed<F>::specs[I].fs;
+	using V = std::remove_cvref_t<T>;
+
+	if constexpr (fs.conv_spec == NPF_FMT_SPEC_CONV_STRING)
+		static_assert(is_string<T>, "%s takes a char pointer or a std::string");
+	else if constexpr (fs.conv_spec == NPF_FMT_SPEC_CONV_CHAR)
+		static_assert(std::is_integral_v<V> && sizeof(V) <= sizeof(int), "%c takes a char");
+	else if constexpr (fs.conv_spec == NPF_FMT_SPEC_CONV_POINTER)
+		static_assert(std::is_pointer_v<std::decay_t<T>> || std::is_null_pointer_v<V>, "%p takes a pointer");
+	else if constexpr (is_float_conv(fs)) {
+		if constexpr (fs.length_modifier == NPF_FMT_SPEC_LEN_MOD_LONG_DOUBLE)
+			static_assert(std::is_floating_point_v<V>, "%Lf, %Le, %Lg and %La take a floating point number");
+		else
+			static_assert(std::is_floating_point_v<V> && sizeof(V) <= sizeof(double), "%f, %e, %g and %a take a float or a double, use %Lf for a long double");
+	}
+	else if constexpr (fs.conv_spec == NPF_FMT_SPEC_CONV_SIGNED_INT || fs.conv_spec == NPF_FMT_SPEC_CONV_UNSIGNED_INT ||
+			fs.conv_spec == NPF_FMT_SPEC_CONV_HEX_INT || fs.conv_spec == NPF_FMT_SPEC_CONV_OCTAL)
+		static_assert(std::is_integral_v<V> && sizeof(V) <= int_size(fs.length_modifier),
+			"%d, %i, %u, %x and %o take an integer no wider than their length modifier says, e.g. %ld for a long");
+	else
+		static_assert(sizeof(V) == 0, "conversion isn't supported");
+}
+
+template <Format F, class... Args>
+consteval void check_args()
+{
+	using P = Parsed<F>;
+
+	static_assert(!P::star, "'*' widths and precisions aren't supported, put them into the format");
+	static_assert(P::args == sizeof...(Args), "number of arguments doesn't match the format");
+	if constexpr (!P::star && P::args == sizeof...(Args)) {
+		[]<std::size_t... K>(std::index_sequence<K...>) {
+			(check_arg<F, P::arg_specs[K], Args>(), ...);
+		}(std::index_sequence_for<Args...>{});
+	}
+}
+
+/* The argument as the C vararg type specs[I]'s conversion reads */
+template <Format F, std::size_t I, class T>
+inline auto promote(const T &v)
+{
+	constexpr npf_format_spec_t fs = Parsed<F>::specs[I].fs;
+	constexpr bool is_signed = fs.conv_spec == NPF_FMT_SPEC_CONV_SIGNED_INT;
+
+	if constexpr (fs.conv_spec == NPF_FMT_SPEC_CONV_STRING) {
+		if constexpr (std::is_same_v<T, std::string>)
+			return v.c_str();
+		else
+			return static_cast<const char *>(v);
+	}
+	else if constexpr (fs.conv_spec == NPF_FMT_SPEC_CONV_CHAR)
+		return static_cast<int>(v);
+	else if constexpr (fs.conv_spec == NPF_FMT_SPEC_CONV_POINTER)
+		return static_cast<const void *>(v);
+	else if constexpr (is_float_conv(fs) && fs.length_modifier == NPF_FMT_SPEC_LEN_MOD_LONG_DOUBLE)
+		return static_cast<long double>(v);
+	else if constexpr (is_float_conv(fs))
+		return static_cast<double>(v);
+	else if constexpr (fs.length_modifier == NPF_FMT_SPEC_LEN_MOD_LONG)
+		return static_cast<std::conditional_t<is_signed, long, unsigned long>>(v);
+	else if constexpr (int_size(fs.length_modifier) > sizeof(long))
+		return static_cast<std::conditional_t<is_signed, long long, unsigned long long>>(v);
+	else
+		return static_cast<std::conditional_t<is_signed, int, unsigned int>>(v);
+}
+
+/* npf_convert for one argument, for specifiers with flags, widths or precisions */
+static inline void convert_one(npf_out_t *out, npf_format_spec_t *fs, ...)
+{
+	va_list ap;
+
+	va_start(ap, fs);
+	npf_convert(out, fs, &ap);
+	va_end(ap);
+}
+
+/* Writes specs[I]'s literal run and its conversion of args */
+template <Format F, std::size_t I, class Tuple>
+inline void put_spec(npf_out_t *out, const Tuple &args)
+{
+	static constexpr Spec s = Parsed<F>::specs[I];
+	constexpr npf_format_spec_t fs = s.fs;
+	constexpr bool plain =
+#if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
+		fs.field_width_opt == NPF_FMT_SPEC_OPT_NONE &&
+#endif
+#if NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 1
+		fs.prec_opt == NPF_FMT_SPEC_OPT_NONE &&
+#endif
+		!fs.prepend && !fs.alt_form &&
+		(fs.length_modifier == NPF_FMT_SPEC_LEN_MOD_NONE || fs.length_modifier == NPF_FMT_SPEC_LEN_MOD_LONG);
+
+	if constexpr (s.literal_len > 0)
+		npf_out_write(out, F.text + s.literal, (int)s.literal_len);
+	if constexpr (!s.spec_len)
+		return;
+	else if constexpr (s.arg < 0 && plain)
+		npf_out_putc(out, '%');
+	else if constexpr (s.arg < 0) {
+		npf_format_spec_t copy = fs;
+
+		convert_one(out, &copy);
+	}
+	else {
+		const auto &arg = std::get<s.arg>(args);
+		auto v = promote<F, I>(arg);
+		[[maybe_unused]] char buf[NANOPRINTF_CONVERSION_BUFFER_SIZE];
+
+		if constexpr (plain && fs.conv_spec == NPF_FMT_SPEC_CONV_STRING) {
+			if constexpr (std::is_same_v<std::tuple_element_t<s.arg, Tuple>, const std::string &>)
+				npf_out_write(out, arg.data(), (int)arg.size());
+			else
+				npf_out_write(out, v, (int)std::strlen(v));
+		}
+		else if constexpr (plain && fs.conv_spec == NPF_FMT_SPEC_CONV_CHAR)
+			npf_out_putc(out, (char)v);
+		else if constexpr (plain && fs.conv_spec == NPF_FMT_SPEC_CONV_SIGNED_INT) {
+			npf_uint_t u = (npf_uint_t)v;
+
+			if (v < 0) {
+				npf_out_putc(out, '-');
+				u = 0 - u;
+			}
+			npf_out_write_rev(out, buf, npf_utoa10_rev(u, buf));
+		}
+		else if constexpr (plain && fs.conv_spec == NPF_FMT_SPEC_CONV_UNSIGNED_INT)
+			npf_out_write_rev(out, buf, npf_utoa10_rev((npf_uint_t)v, buf));
+		else if constexpr (plain && fs.conv_spec == NPF_FMT_SPEC_CONV_HEX_INT)
+			npf_out_write_rev(out, buf, npf_utoa_pow2_rev((npf_uint_t)v, buf, 4, fs.case_adjust));
+		else {
+			npf_format_spec_t copy = fs;
+
+			convert_one(out, &copy, v);
+		}
+	}
+}
+
+/* Formats the message into size bytes at message, returns its whole length like npf_vsnprintf */
+template <Format F, class... Args>
+inline int format(char *message, int size, const Args &...args)
+{
+	npf_out_t out = { nullptr, nullptr, message, (std::size_t)size, 0 };
+	std::tuple<const Args &...> refs(args...);
+
+	[&]<std::size_t... I>(std::index_sequence<I...>) {
+		(put_spec<F, I>(&out, refs), ...);
+	}(std::make_index_sequence<Parsed<F>::count + 1>{});
+	return out.n;
+}
+
+/* Second pass for lines that didn't fit into LOG_CXX_SINGLE_PASS_SIZE, out of line so the common case doesn't reserve its stack */
+template <Format F, class... Args>
+__attribute__((noinline)) int write_long(FILE *stream, int level, int tag, const Args &...args)
+{
+	char line[LOG_LINE_HEADROOM + LOG_CXX_LINE_SIZE];
+	char *message = line + LOG_LINE_HEADROOM;
+
+	return lline_write(stream, level, tag, F.text, message, LOG_CXX_LINE_SIZE, format<F>(message, LOG_CXX_LINE_SIZE, args...));
+}
+
+template <Format F, class... Args>
+inline int write(FILE *stream, int level, int tag, const Args &...args)
+{
+	char line[LOG_LINE_HEADROOM + LOG_CXX_SINGLE_PASS_SIZE];
+	char *message = line + LOG_LINE_HEADROOM;
+	int len;
+
+	switch (lline_begin(level, F.text)) {
+		case 0:
+			return 0;
+		case -1:
+			return [&]<std::size_t... K>(std::index_sequence<K...>) {
+				return lline_printf(stream, level, tag, F.text, promote<F, Parsed<F>::arg_specs[K]>(args)...);
+			}(std::index_sequence_for<Args...>{});
+	}
+	len = format<F>(message, LOG_CXX_SINGLE_PASS_SIZE, args...);
+	if (len > LOG_CXX_SINGLE_PASS_SIZE - 1) [[unlikely]]
+		return write_long<F>(stream, level, tag, args...);
+	return lline_write(stream, level, tag, F.text, message, LOG_CXX_SINGLE_PASS_SIZE, len);
+}
+
+} /* namespace detail */
+
+/* lfprintf: format may start with a level tag, the line goes to the tag's stream if stream is NULL */
+/* MT-safe locale | AS-safe | AC-safe */
+template <Format F, class... Args>
+inline int fprint(FILE *stream, const Args &...args)
+{
+	constexpr int level = detail::Parsed<F>::tag;
+
+	detail::check_args<F, Args...>();
+	if (level != LOG_NONE && !log_enabled(level))
+		return 0;
+	return detail::write<F>(stream, level, LOG_NONE, args...);
+}
+
+/* lprintf */
+/* MT-safe locale | AS-safe | AC-safe */
+template <Format F, class... Args>
+inline int print(const Args &...args)
+{
+	return fprint<F>(nullptr, args...);
+}
+
+/* llprintf: Level's tag gets added, so format must not start with one. Levels above LOG_COMPILE_LEVEL compile to nothing */
+/* MT-safe locale | AS-safe | AC-safe */
+template <int Level, Format F, class... Args>
+inline int log(const Args &...args)
+{
+	static_assert(Level >= LOG_ERROR && Level <= LOG_REMOTE, "Level is one of LOG_ERROR..LOG_REMOTE");
+	static_assert(detail::Parsed<F>::tag == LOG_NONE, "format must not start with a tag, it gets added");
+	detail::check_args<F, Args...>();
+	if constexpr (Level != LOG_REMOTE && Level > LOG_COMPILE_LEVEL)
+		return 0;
+	else {
+		if (!log_enabled(Level))
+			return 0;
+		return detail::write<F>(nullptr, Level, Level, args...);
+	}
+}
+
+template <Format F, class... Args> inline int error(const Args &...args) { return log<LOG_ERROR, F>(args...); }
+template <Format F, class... Args> inline int warning(const Args &...args) { return log<LOG_WARNING, F>(args...); }
+template <Format F, class... Args> inline int info(const Args &...args) { return log<LOG_INFO, F>(args...); }
+template <Format F, class... Args> inline int debug(const Args &...args) { return log<LOG_DEBUG, F>(args...); }
+template <Format F, class... Args> inline int remote(const Args &...args) { return log<LOG_REMOTE, F>(args...); }
+
+} /* namespace logging */
+
+#endif /* _LOG_HPP */
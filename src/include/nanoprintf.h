@@ -64,6 +64,7 @@ NPF_VISIBILITY int npf_vpprintf(
 
 #include <limits.h>
 #include <stdint.h>
+#include <string.h>
 
 // The conversion buffer must fit at least UINT64_MAX in octal format with the leading '0'.
 #ifndef NANOPRINTF_CONVERSION_BUFFER_SIZE
@@ -108,11 +109,28 @@ NPF_VISIBILITY int npf_vpprintf(
 	#error NANOPRINTF_USE_WRITEBACK_FORMAT_SPECIFIERS must be #defined to 0 or 1
 #endif
 
+// Exact %f/%e/%g that print what glibc prints, instead of the compact approximation.
+#ifndef NANOPRINTF_USE_EXACT_FLOAT_FORMAT_SPECIFIERS
+	#define NANOPRINTF_USE_EXACT_FLOAT_FORMAT_SPECIFIERS 0
+#endif
+// Room for an exactly converted float: DBL_MAX with %f takes 309 digits before the point.
+#ifndef NANOPRINTF_FLOAT_BUFFER_SIZE
+	#define NANOPRINTF_FLOAT_BUFFER_SIZE 400
+#endif
+// Specifiers a format may have for npf_compile_format to take it.
+#ifndef NANOPRINTF_COMPILED_SPECS
+	#define NANOPRINTF_COMPILED_SPECS 12
+#endif
+
 // Ensure flags are compatible.
 #if (NANOPRINTF_USE_FLOAT_FORMAT_SPECIFIERS == 1) && \
 		(NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 0)
 	#error Precision format specifiers must be enabled if float support is enabled.
 #endif
+#if (NANOPRINTF_USE_EXACT_FLOAT_FORMAT_SPECIFIERS == 1) && \
+		(NANOPRINTF_USE_FLOAT_FORMAT_SPECIFIERS == 0)
+	#error Exact float formatting needs float format specifiers enabled.
+#endif
 
 // intmax_t / uintmax_t require stdint from c99 / c++11
 #if NANOPRINTF_USE_LARGE_FORMAT_SPECIFIERS == 1
@@ -188,6 +206,13 @@ NPF_VISIBILITY int npf_vpprintf(
 	#pragma warning(disable:26812) // enum type is unscoped
 #endif
 
+// Lets C++20 code parse format specifiers at compile time.
+#if defined(__cplusplus) && (__cplusplus >= 202002L)
+	#define NPF_CONSTEXPR constexpr
+#else
+	#define NPF_CONSTEXPR
+#endif
+
 #if defined(__clang__) || defined(__GNUC__) || defined(__GNUG__)
 	#define NPF_NOINLINE __attribute__((noinline))
 #elif defined(_MSC_VER)
@@ -269,12 +294,6 @@ typedef struct npf_format_spec {
 	typedef uintmax_t npf_uint_t;
 #endif
 
-typedef struct npf_bufputc_ctx {
-	char *dst;
-	size_t len;
-	size_t cur;
-} npf_bufputc_ctx_t;
-
 #if NANOPRINTF_USE_LARGE_FORMAT_SPECIFIERS == 1
 	typedef char npf_size_is_ptrdiff[(sizeof(size_t) == sizeof(ptrdiff_t)) ? 1 : -1];
 	typedef ptrdiff_t npf_ssize_t;
@@ -286,7 +305,7 @@ typedef struct npf_bufputc_ctx {
 
 static int npf_max(int x, int y) { return (x > y) ? x : y; }
 
-static int npf_parse_format_spec(char const *format, npf_format_spec_t *out_spec) {
+static NPF_CONSTEXPR int npf_parse_format_spec(char const *format, npf_format_spec_t *out_spec) {
 	char const *cur = format;
 
 #if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
@@ -469,7 +488,7 @@ static int npf_parse_format_spec(char const *format, npf_format_spec_t *out_spec
 	return (int)(cur - format);
 }
 
-static NPF_NOINLINE int npf_utoa_rev(
+static NPF_NOINLINE int npf_utoa_rev_generic(
 		npf_uint_t val, char *buf, uint_fast8_t base, char case_adj) {
 	uint_fast8_t n = 0;
 	do {
@@ -481,6 +500,55 @@ static NPF_NOINLINE int npf_utoa_rev(
 	return (int)n;
 }
 
+// Two decimal digits per division, the pair for r at npf_digit_pairs[2 * r].
+static char const npf_digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static int npf_utoa10_rev(npf_uint_t val, char *buf) {
+	char *p = buf;
+	// Constant divisors compile to multiplications.
+	while (val >= 100) {
+		unsigned const r = (unsigned)(val % 100);
+		val /= 100;
+		p[0] = npf_digit_pairs[2 * r + 1];
+		p[1] = npf_digit_pairs[2 * r];
+		p += 2;
+	}
+	if (val >= 10) {
+		p[0] = npf_digit_pairs[2 * val + 1];
+		p[1] = npf_digit_pairs[2 * val];
+		p += 2;
+	} else {
+		*p++ = (char)('0' + val);
+	}
+	return (int)(p - buf);
+}
+
+// Power-of-two bases need no division: a mask and a shift per digit.
+static int npf_utoa_pow2_rev(npf_uint_t val, char *buf, unsigned shift, char case_adj) {
+	static char const digits[] = "0123456789abcdef0123456789ABCDEF";
+	char const *table = digits + (case_adj ? 0 : 16);
+	npf_uint_t const mask = ((npf_uint_t)1 << shift) - 1;
+	char *p = buf;
+	do {
+		*p++ = table[val & mask];
+		val >>= shift;
+	} while (val);
+	return (int)(p - buf);
+}
+
+static int npf_utoa_rev(
+		npf_uint_t val, char *buf, uint_fast8_t base, char case_adj) {
+	switch (base) {
+		case 10: return npf_utoa10_rev(val, buf);
+		case 16: return npf_utoa_pow2_rev(val, buf, 4, case_adj);
+		case 8: return npf_utoa_pow2_rev(val, buf, 3, case_adj);
+		default: return npf_utoa_rev_generic(val, buf, base, case_adj);
+	}
+}
+
 #if NANOPRINTF_USE_FLOAT_FORMAT_SPECIFIERS == 1
 
 #include <float.h>
@@ -680,6 +748,398 @@ exit:
 	return (int)i;
 }
 
+
+#if NANOPRINTF_USE_EXACT_FLOAT_FORMAT_SPECIFIERS == 1
+/* Exact %f, %e and %g: digits come from the double's exact binary value, rounded half-to-even
+	 like glibc does. The integer part is converted by repeated division by a power of ten, the
+	 fraction produces a chunk of digits per multiplication by that power with its bits aligned to
+	 the top of a limb array, so the bits that carry out are the next digits. With 128-bit
+	 arithmetic the limbs are 64 bits and a chunk is 19 digits, otherwise 32 bits and 9 digits.
+	 Values of everyday magnitude take one or two limbs, only the extremes of the exponent range
+	 walk the full arrays. The zeros after the point of tiny values only grow the array up to its
+	 first nonzero limb instead of multiplying all of it. */
+
+#ifdef __SIZEOF_INT128__
+typedef uint64_t npf_limb_t;
+typedef unsigned __int128 npf_dlimb_t;
+#define NPF_LIMB_BITS 64
+#define NPF_CHUNK_DIGITS 19
+#define NPF_BIG_BASE 10000000000000000000ull
+#else
+typedef uint32_t npf_limb_t;
+typedef uint64_t npf_dlimb_t;
+#define NPF_LIMB_BITS 32
+#define NPF_CHUNK_DIGITS 9
+#define NPF_BIG_BASE 1000000000ull
+#endif
+
+enum {
+	NPF_BIG_LIMBS = 1152 / NPF_LIMB_BITS, // 2^1024 integers and the 1074 fraction bits of subnormals
+	NPF_INT_CHUNKS = (309 + NPF_CHUNK_DIGITS - 1) / NPF_CHUNK_DIGITS // 309 digits
+};
+
+typedef struct npf_frac {
+	npf_limb_t limb[NPF_BIG_LIMBS]; // value = limb[lo..hi) / 2^(NPF_LIMB_BITS * (hi - lo)), little-endian
+	int lo, hi, top; // limb[top..hi) are zero: the leading zeros after the point of small values
+	char chunk[NPF_CHUNK_DIGITS]; // Digits of the last multiplication not handed out yet
+	int chunk_left;
+} npf_frac_t;
+
+// limb[] |= v << bit, for limb[] big enough to hold it
+static void npf_big_put(npf_limb_t *limb, uint64_t v, int bit) {
+	for (int i = bit / NPF_LIMB_BITS, sh = bit % NPF_LIMB_BITS; v; ++i) {
+		limb[i] |= (npf_limb_t)(v << sh);
+		v = (v >> 1) >> (NPF_LIMB_BITS - 1 - sh);
+		sh = 0;
+	}
+}
+
+static void npf_nine_digits(char *d, uint32_t c) { // c < 10^9, leading zeros included
+	for (int i = 7; i > 0; i -= 2) {
+		unsigned const r = c % 100;
+		c /= 100;
+		d[i] = npf_digit_pairs[2 * r];
+		d[i + 1] = npf_digit_pairs[2 * r + 1];
+	}
+	d[0] = (char)('0' + c);
+}
+
+// All NPF_CHUNK_DIGITS digits of c < NPF_BIG_BASE, nine at a time in 32 bits
+static void npf_chunk_digits(char *d, npf_limb_t c) {
+#if NPF_CHUNK_DIGITS == 19
+	d[0] = (char)('0' + c / 1000000000000000000ull);
+	c %= 1000000000000000000ull;
+	npf_nine_digits(d + 1, (uint32_t)(c / 1000000000u));
+	npf_nine_digits(d + 10, (uint32_t)(c % 1000000000u));
+#else
+	npf_nine_digits(d, c);
+#endif
+}
+
+// (hi:lo) / NPF_BIG_BASE, remainder in *lo, for hi < NPF_BIG_BASE
+static npf_limb_t npf_big_div(npf_limb_t hi, npf_limb_t *lo) {
+#ifdef __SIZEOF_INT128__
+	// 10^19 has its top bit set, so a precomputed reciprocal stands in for the 128-bit division
+	// (Moeller and Granlund, "Improved division by invariant integers")
+	npf_dlimb_t const p = (npf_dlimb_t)0xd83c94fb6d2ac34aull * hi + (((npf_dlimb_t)hi << 64) | *lo);
+	npf_limb_t q = (npf_limb_t)(p >> 64) + 1;
+	npf_limb_t r = *lo - q * NPF_BIG_BASE;
+	npf_limb_t const under = (npf_limb_t)0 - (npf_limb_t)(r > (npf_limb_t)p); // Without a branch, it's unpredictable
+	q += under;
+	r += under & NPF_BIG_BASE;
+	if (r >= NPF_BIG_BASE) { ++q; r -= NPF_BIG_BASE; }
+	*lo = r;
+	return q;
+#else
+	npf_dlimb_t const t = ((npf_dlimb_t)hi << NPF_LIMB_BITS) | *lo;
+	*lo = (npf_limb_t)(t % NPF_BIG_BASE);
+	return (npf_limb_t)(t / NPF_BIG_BASE);
+#endif
+}
+
+static void npf_frac_init(npf_frac_t *f, uint64_t bits, int shift) {
+	// bits / 2^shift, bits < 2^shift
+	int const limbs = (shift + NPF_LIMB_BITS - 1) / NPF_LIMB_BITS;
+	f->lo = 0;
+	f->hi = limbs;
+	f->chunk_left = 0;
+	for (int i = 0; i < limbs; ++i) { f->limb[i] = 0; }
+	npf_big_put(f->limb, bits, limbs * NPF_LIMB_BITS - shift);
+	f->top = limbs;
+	while ((f->top > 0) && !f->limb[f->top - 1]) { --f->top; }
+	while ((f->lo < f->top) && !f->limb[f->lo]) { ++f->lo; }
+}
+
+static int npf_frac_nonzero(npf_frac_t const *f) {
+	for (int i = NPF_CHUNK_DIGITS - f->chunk_left; i < NPF_CHUNK_DIGITS; ++i) {
+		if (f->chunk[i] != '0') { return 1; }
+	}
+	return f->lo < f->top;
+}
+
+// Multiplies by NPF_BIG_BASE for the next chunk of digits. Returns 1 and leaves the chunk out
+// while the value is still too small for a nonzero digit.
+static int npf_frac_chunk(npf_frac_t *f) {
+	npf_limb_t carry = 0;
+	for (int i = f->lo; i < f->top; ++i) {
+		npf_dlimb_t const t = (npf_dlimb_t)f->limb[i] * NPF_BIG_BASE + carry;
+		f->limb[i] = (npf_limb_t)t;
+		carry = (npf_limb_t)(t >> NPF_LIMB_BITS);
+	}
+	while ((f->lo < f->top) && !f->limb[f->lo]) { ++f->lo; }
+	if (f->top < f->hi) {
+		if (carry) { f->limb[f->top++] = carry; }
+		return 1;
+	}
+	npf_chunk_digits(f->chunk, carry);
+	f->chunk_left = NPF_CHUNK_DIGITS;
+	return 0;
+}
+
+static char npf_frac_digit(npf_frac_t *f) {
+	if (!f->chunk_left && npf_frac_chunk(f)) {
+		for (int i = 0; i < NPF_CHUNK_DIGITS; ++i) { f->chunk[i] = '0'; }
+		f->chunk_left = NPF_CHUNK_DIGITS;
+	}
+	return f->chunk[NPF_CHUNK_DIGITS - f->chunk_left--];
+}
+
+// Skips the zeros right after the point of a nonzero fraction, returns their count
+static int npf_frac_zeros(npf_frac_t *f) {
+	int z = 0;
+	for (;;) {
+		if (!f->chunk_left && npf_frac_chunk(f)) {
+			z += NPF_CHUNK_DIGITS;
+			continue;
+		}
+		if (f->chunk[NPF_CHUNK_DIGITS - f->chunk_left] != '0') { return z; }
+		--f->chunk_left;
+		++z;
+	}
+}
+
+// Writes the decimal digits of m * 2^e, e >= 0, to d. Returns their count, 0 for zero.
+static int npf_int_digits(char *d, uint64_t m, int e) {
+	if (!m) { return 0; }
+	if (e < 11) { // fits 64 bits
+		char rev[20];
+		int const n = npf_utoa10_rev((npf_uint_t)(m << e), rev);
+		for (int i = 0; i < n; ++i) { d[i] = rev[n - 1 - i]; }
+		return n;
+	}
+	npf_limb_t limb[NPF_BIG_LIMBS], chunks[NPF_INT_CHUNKS];
+	int n = (e + 64 + NPF_LIMB_BITS - 1) / NPF_LIMB_BITS, nchunks = 0, len = 0;
+	for (int i = 0; i < n; ++i) { limb[i] = 0; }
+	npf_big_put(limb, m, e);
+	while (n && !limb[n - 1]) { --n; }
+	while (n) {
+		npf_limb_t rem = 0;
+		for (int i = n - 1; i >= 0; --i) {
+			npf_limb_t r = limb[i];
+			limb[i] = npf_big_div(rem, &r);
+			rem = r;
+		}
+		chunks[nchunks++] = rem;
+		while (n && !limb[n - 1]) { --n; }
+	}
+	{ // The top chunk without leading zeros, the others with all their digits
+		char top[NPF_CHUNK_DIGITS];
+		int i = 0;
+		npf_chunk_digits(top, chunks[--nchunks]);
+		while (top[i] == '0') { ++i; }
+		for (; i < NPF_CHUNK_DIGITS; ++i) { d[len++] = top[i]; }
+	}
+	while (nchunks--) {
+		npf_chunk_digits(d + len, chunks[nchunks]);
+		len += NPF_CHUNK_DIGITS;
+	}
+	return len;
+}
+
+/* Writes the digits of val, finite and not negative, rounded to the given count of fraction
+	 digits (fixed) or significant digits (!fixed) into d. *exp10 gets the power of ten of d[0].
+	 Returns the count of digits, -1 if they don't fit cap. */
+static int npf_exact_digits(char *d, int cap, double val, int fixed, int count, int *exp10) {
+	npf_double_bin_t bin; { // Union-cast is UB pre-C11, compiler optimizes byte-copy loop.
+		char const *src = (char const *)&val;
+		char *dst = (char *)&bin;
+		for (uint_fast8_t i = 0; i < sizeof(val); ++i) { dst[i] = src[i]; }
+	}
+	int const biased = (int)((bin >> NPF_DOUBLE_MAN_BITS) & NPF_DOUBLE_EXP_MASK);
+	uint64_t m = (uint64_t)(bin & (((npf_double_bin_t)0x1 << NPF_DOUBLE_MAN_BITS) - 1));
+	int e = biased ? (biased - NPF_DOUBLE_EXP_BIAS - NPF_DOUBLE_MAN_BITS) : (1 - NPF_DOUBLE_EXP_BIAS - NPF_DOUBLE_MAN_BITS);
+	if (biased) { m |= (uint64_t)1 << NPF_DOUBLE_MAN_BITS; }
+
+#ifdef __SIZEOF_INT128__
+	// Fixed notation of everyday values: round(m * 10^count / 2^-e) in 128-bit arithmetic
+	if (fixed && (e < 0) && (e > -128) && (count <= 19)) {
+		static uint64_t const pow10[] = { 1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull,
+			10000000ull, 100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+			10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+			100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull };
+		unsigned __int128 const scaled = (unsigned __int128)m * pow10[count];
+		unsigned __int128 const half = (unsigned __int128)1 << (-e - 1);
+		unsigned __int128 q = scaled >> -e;
+		unsigned __int128 const rem = scaled & ((half << 1) - 1);
+		if ((rem > half) || ((rem == half) && (q & 1))) { ++q; }
+		if (!(q >> 64)) {
+			char rev[20];
+			int n = npf_utoa10_rev((npf_uint_t)(uint64_t)q, rev), len = 0;
+			if (n > cap) { return -1; }
+			if (n <= count) { // No integer digits: zeros right after the point come first
+				if (count > cap) { return -1; }
+				for (; len < count - n; ++len) { d[len] = '0'; }
+				*exp10 = -1;
+			} else {
+				*exp10 = n - count - 1;
+			}
+			while (n) { d[len++] = rev[--n]; }
+			return len;
+		}
+	}
+#endif
+
+	char idig[NPF_INT_CHUNKS * NPF_CHUNK_DIGITS];
+	npf_frac_t f;
+	int int_len, n = 0, next = 0, want, taken = 0;
+	if (e >= 0) {
+		int_len = npf_int_digits(idig, m, e);
+		npf_frac_init(&f, 0, 1);
+	} else {
+		int_len = (e > -64) ? npf_int_digits(idig, m >> -e, 0) : 0;
+		npf_frac_init(&f, (e > -64) ? (m & (((uint64_t)1 << -e) - 1)) : m, -e);
+	}
+
+	if (fixed) {
+		*exp10 = int_len ? (int_len - 1) : -1;
+		want = int_len + count;
+	} else if (int_len) {
+		*exp10 = int_len - 1;
+		want = count;
+	} else if (!m) { // zero
+		*exp10 = 0;
+		want = count;
+		npf_frac_init(&f, 0, 1);
+	} else { // Skip the zeros after the decimal point
+		int const z = npf_frac_zeros(&f);
+		next = npf_frac_digit(&f);
+		*exp10 = -(z + 1);
+		want = count;
+		if (want > cap) { return -1; }
+		if (want) { d[n++] = (char)next; }
+		next = 0;
+	}
+	if (want > cap) { return -1; }
+
+	// The digits, then the first one left out and whether anything after it is nonzero
+	for (; (n < want) && (taken < int_len); ++n) { d[n] = idig[taken++]; }
+	for (; n < want; ++n) { d[n] = npf_frac_digit(&f); }
+	int sticky;
+	if (taken < int_len) {
+		next = idig[taken++];
+		sticky = npf_frac_nonzero(&f);
+		for (; !sticky && (taken < int_len); ++taken) { sticky = (idig[taken] != '0'); }
+	} else if (!next) {
+		next = npf_frac_digit(&f);
+		sticky = npf_frac_nonzero(&f);
+	} else {
+		sticky = npf_frac_nonzero(&f);
+	}
+
+	int const last_odd = n ? ((d[n - 1] - '0') & 1) : 0;
+	if ((next > '5') || ((next == '5') && (sticky || last_odd))) {
+		int i = n;
+		while (i && (d[i - 1] == '9')) { d[--i] = '0'; }
+		if (i) {
+			++d[i - 1];
+		} else { // 99.9 -> 100.0: one more integer digit, or one more power of ten
+			++*exp10;
+			if (fixed) {
+				if (n + 1 > cap) { return -1; }
+				for (int j = n; j > 0; --j) { d[j] = d[j - 1]; }
+				++n;
+			}
+			d[0] = '1';
+		}
+	}
+	return n;
+}
+
+static int npf_double_negative(double val) { // -0.0 and -NAN as well
+	npf_double_bin_t bin;
+	char const *src = (char const *)&val;
+	char *dst = (char *)&bin;
+	for (uint_fast8_t i = 0; i < sizeof(val); ++i) { dst[i] = src[i]; }
+	return (int)(bin >> (NPF_DOUBLE_BIN_BITS - 1));
+}
+
+static int npf_put_exp(char *buf, int exp10, char e) {
+	int n = 0;
+	buf[n++] = e;
+	buf[n++] = (exp10 < 0) ? '-' : '+';
+	if (exp10 < 0) { exp10 = -exp10; }
+	if (exp10 >= 100) { buf[n++] = (char)('0' + exp10 / 100); }
+	buf[n++] = (char)('0' + exp10 / 10 % 10);
+	buf[n++] = (char)('0' + exp10 % 10);
+	return n;
+}
+
+static int npf_ftoa_error(char *buf, npf_format_spec_t const *spec) {
+	int len;
+	for (len = 0; len < 3; ++len) { buf[len] = (char)("ERR"[len] + spec->case_adjust); }
+	return len;
+}
+
+/* Writes |val| in the order it's printed (not reversed) as %f, %e or %g with spec's precision
+	 and '#' flag would print it. Returns the length, or of "ERR" if it doesn't fit size. */
+static int npf_ftoa_exact(char *buf, int size, npf_format_spec_t const *spec, double val) {
+	char d[NANOPRINTF_FLOAT_BUFFER_SIZE];
+	char const *special = NULL;
+	int const upper = !spec->case_adjust;
+	int exp10, n, len = 0, prec = spec->prec;
+
+	if (val != val) { special = "NAN"; }
+	else if ((val - val) != (val - val)) { special = "INF"; }
+	if (special) {
+		for (; special[len]; ++len) { buf[len] = (char)(special[len] + spec->case_adjust); }
+		return len;
+	}
+	if (val < 0) { val = -val; }
+
+	if (spec->conv_spec == NPF_FMT_SPEC_CONV_FLOAT_DEC) {
+		n = npf_exact_digits(d, (int)sizeof(d), val, 1, prec, &exp10);
+		int const int_len = n - prec;
+		if ((n < 0) || (((int_len > 0) ? int_len : 1) + 1 + prec > size)) { return npf_ftoa_error(buf, spec); }
+		if (int_len > 0) {
+			for (int i = 0; i < int_len; ++i) { buf[len++] = d[i]; }
+		} else {
+			buf[len++] = '0';
+		}
+		if (prec || spec->alt_form) { buf[len++] = '.'; }
+		for (int i = (int_len > 0) ? int_len : 0; i < n; ++i) { buf[len++] = d[i]; }
+		return len;
+	}
+
+	int const sig = (spec->conv_spec == NPF_FMT_SPEC_CONV_FLOAT_SCI) ? (prec + 1) : (prec ? prec : 1);
+	n = npf_exact_digits(d, (int)sizeof(d), val, 0, sig, &exp10);
+	if (n < 0) { return npf_ftoa_error(buf, spec); }
+	int strip = 0;
+	if (spec->conv_spec == NPF_FMT_SPEC_CONV_FLOAT_SHORTEST) {
+		strip = !spec->alt_form;
+		if ((exp10 < sig) && (exp10 >= -4)) { // %f with sig - 1 - exp10 fraction digits
+			int const frac = sig - 1 - exp10;
+			int const int_len = (exp10 >= 0) ? (exp10 + 1) : 0;
+			if (((int_len > 0) ? int_len : 1) + 1 + frac > size) { return npf_ftoa_error(buf, spec); }
+			if (int_len) {
+				for (int i = 0; i < int_len; ++i) { buf[len++] = d[i]; }
+			} else {
+				buf[len++] = '0';
+			}
+			int const point = len;
+			buf[len++] = '.';
+			for (int i = 0; i < -exp10 - 1; ++i) { buf[len++] = '0'; }
+			for (int i = int_len; i < n; ++i) { buf[len++] = d[i]; }
+			if (strip) {
+				while ((len > point + 1) && (buf[len - 1] == '0')) { --len; }
+			}
+			if ((len == point + 1) && !spec->alt_form) { --len; }
+			return len;
+		}
+	}
+	if (n + 7 > size) { return npf_ftoa_error(buf, spec); }
+	buf[len++] = d[0];
+	int const point = len;
+	buf[len++] = '.';
+	for (int i = 1; i < n; ++i) { buf[len++] = d[i]; }
+	if (strip) {
+		while ((len > point + 1) && (buf[len - 1] == '0')) { --len; }
+	}
+	if ((len == point + 1) && !spec->alt_form) { --len; }
+	len += npf_put_exp(buf + len, exp10, upper ? 'E' : 'e');
+	return len;
+}
+#endif // NANOPRINTF_USE_EXACT_FLOAT_FORMAT_SPECIFIERS
+
 #endif // NANOPRINTF_USE_FLOAT_FORMAT_SPECIFIERS
 
 #if NANOPRINTF_USE_BINARY_FORMAT_SPECIFIERS == 1
@@ -721,321 +1181,454 @@ static int npf_bin_len(npf_uint_t u) {
 }
 #endif
 
-static void npf_bufputc(int c, void *ctx) {
-	npf_bufputc_ctx_t *bpc = (npf_bufputc_ctx_t *)ctx;
-	if (bpc->cur < bpc->len) { bpc->dst[bpc->cur++] = (char)c; }
+// Output goes either through a putc callback or, with pc == NULL, straight into a buffer, where
+// literal runs, converted digits, strings and padding are copied as whole spans with one bounds
+// check each instead of an indirect call per character.
+typedef struct npf_out {
+	npf_putc pc;
+	void *pc_ctx;
+	char *dst;
+	size_t len; // Bytes of dst that may be written
+	int n;      // Characters produced so far, written or not
+} npf_out_t;
+
+static size_t npf_out_room(npf_out_t const *o, int len) {
+	size_t const cur = (size_t)o->n;
+	if (cur >= o->len) { return 0; }
+	return ((size_t)len < o->len - cur) ? (size_t)len : (o->len - cur);
 }
 
-static void npf_bufputc_nop(int c, void *ctx) { (void)c; (void)ctx; }
+static void npf_out_putc(npf_out_t *o, char c) {
+	if (o->pc) {
+		o->pc(c, o->pc_ctx);
+	} else if ((size_t)o->n < o->len) {
+		o->dst[o->n] = c;
+	}
+	++o->n;
+}
 
-typedef struct npf_cnt_putc_ctx {
-	npf_putc pc;
-	void *ctx;
-	int n;
-} npf_cnt_putc_ctx_t;
+static void npf_out_write(npf_out_t *o, char const *s, int len) {
+	if (o->pc) {
+		for (int i = 0; i < len; ++i) { o->pc(s[i], o->pc_ctx); }
+	} else {
+		size_t const room = npf_out_room(o, len);
+		if (room) { memcpy(o->dst + o->n, s, room); }
+	}
+	o->n += len;
+}
 
-static void npf_putc_cnt(int c, void *ctx) {
-	npf_cnt_putc_ctx_t *pc_cnt = (npf_cnt_putc_ctx_t *)ctx;
-	++pc_cnt->n;
-	pc_cnt->pc(c, pc_cnt->ctx); // sibling-call optimization
+// s holds len characters in reverse order, as the integer and float conversions produce them.
+static void npf_out_write_rev(npf_out_t *o, char const *s, int len) {
+	if (o->pc) {
+		for (int i = len - 1; i >= 0; --i) { o->pc(s[i], o->pc_ctx); }
+	} else {
+		size_t const room = npf_out_room(o, len);
+		for (size_t i = 0; i < room; ++i) { o->dst[(size_t)o->n + i] = s[len - 1 - (int)i]; }
+	}
+	o->n += len;
+}
+
+static void npf_out_fill(npf_out_t *o, char c, int count) {
+	if (count <= 0) { return; }
+	if (o->pc) {
+		for (int i = 0; i < count; ++i) { o->pc(c, o->pc_ctx); }
+	} else {
+		size_t const room = npf_out_room(o, count);
+		if (room) { memset(o->dst + o->n, c, room); }
+	}
+	o->n += count;
 }
 
-#define NPF_PUTC(VAL) do { npf_putc_cnt((int)(VAL), &pc_cnt); } while (0)
+#define NPF_PUTC(VAL) do { npf_out_putc(out, (char)(VAL)); } while (0)
 
 #define NPF_EXTRACT(MOD, CAST_TO, EXTRACT_AS) \
-	case NPF_FMT_SPEC_LEN_MOD_##MOD: val = (CAST_TO)va_arg(args, EXTRACT_AS); break
+	case NPF_FMT_SPEC_LEN_MOD_##MOD: val = (CAST_TO)va_arg(*args, EXTRACT_AS); break
 
 #define NPF_WRITEBACK(MOD, TYPE) \
-	case NPF_FMT_SPEC_LEN_MOD_##MOD: *(va_arg(args, TYPE *)) = (TYPE)pc_cnt.n; break
+	case NPF_FMT_SPEC_LEN_MOD_##MOD: *(va_arg(*args, TYPE *)) = (TYPE)out->n; break
 
-int npf_vpprintf(npf_putc pc, void *pc_ctx, char const *format, va_list args) {
-	npf_format_spec_t fs;
-	char const *cur = format;
-	npf_cnt_putc_ctx_t pc_cnt;
-	pc_cnt.pc = pc;
-	pc_cnt.ctx = pc_ctx;
-	pc_cnt.n = 0;
-
-	while (*cur) {
-		int const fs_len = (*cur != '%') ? 0 : npf_parse_format_spec(cur, &fs);
-		if (!fs_len) { NPF_PUTC(*cur++); continue; }
-		cur += fs_len;
-
-		// Extract star-args immediately
+// Converts one parsed specifier, taking its arguments from *args
+static void npf_convert(npf_out_t *out, npf_format_spec_t *fs, va_list *args) {
+	// Extract star-args immediately
 #if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
-		if (fs.field_width_opt == NPF_FMT_SPEC_OPT_STAR) {
-			fs.field_width = va_arg(args, int);
-			if (fs.field_width < 0) {
-				fs.field_width = -fs.field_width;
-				fs.left_justified = 1;
-			}
+	if (fs->field_width_opt == NPF_FMT_SPEC_OPT_STAR) {
+		fs->field_width = va_arg(*args, int);
+		if (fs->field_width < 0) {
+			fs->field_width = -fs->field_width;
+			fs->left_justified = 1;
 		}
+	}
 #endif
 #if NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 1
-		if (fs.prec_opt == NPF_FMT_SPEC_OPT_STAR) {
-			fs.prec = va_arg(args, int);
-			if (fs.prec < 0) { fs.prec_opt = NPF_FMT_SPEC_OPT_NONE; }
-		}
+	if (fs->prec_opt == NPF_FMT_SPEC_OPT_STAR) {
+		fs->prec = va_arg(*args, int);
+		if (fs->prec < 0) { fs->prec_opt = NPF_FMT_SPEC_OPT_NONE; }
+	}
 #endif
 
-		union { char cbuf_mem[NANOPRINTF_CONVERSION_BUFFER_SIZE]; npf_uint_t binval; } u;
-		char *cbuf = u.cbuf_mem, sign_c = 0;
-		int cbuf_len = 0, need_0x = 0;
+	union { char cbuf_mem[NANOPRINTF_CONVERSION_BUFFER_SIZE]; npf_uint_t binval; } u;
+	char *cbuf = u.cbuf_mem, sign_c = 0;
+	int cbuf_len = 0, need_0x = 0, cbuf_forward = 0;
+#if NANOPRINTF_USE_EXACT_FLOAT_FORMAT_SPECIFIERS == 1
+	char fbuf[NANOPRINTF_FLOAT_BUFFER_SIZE];
+#endif
 #if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
-		int field_pad = 0;
-		char pad_c = 0;
+	int field_pad = 0;
+	char pad_c = 0;
 #endif
 #if NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 1
-		int prec_pad = 0;
+	int prec_pad = 0;
 #if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
-		int zero = 0;
+	int zero = 0;
 #endif
 #endif
 
-		// Extract and convert the argument to string, point cbuf at the text.
-		switch (fs.conv_spec) {
-			case NPF_FMT_SPEC_CONV_PERCENT:
-				*cbuf = '%';
-				cbuf_len = 1;
-				break;
+	// Extract and convert the argument to string, point cbuf at the text.
+	switch (fs->conv_spec) {
+		case NPF_FMT_SPEC_CONV_PERCENT:
+			*cbuf = '%';
+			cbuf_len = 1;
+			break;
 
-			case NPF_FMT_SPEC_CONV_CHAR:
-				*cbuf = (char)va_arg(args, int);
-				cbuf_len = 1;
-				break;
+		case NPF_FMT_SPEC_CONV_CHAR:
+			*cbuf = (char)va_arg(*args, int);
+			cbuf_len = 1;
+			break;
 
-			case NPF_FMT_SPEC_CONV_STRING: {
-				cbuf = va_arg(args, char *);
+		case NPF_FMT_SPEC_CONV_STRING: {
+			cbuf = va_arg(*args, char *);
 #if NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 1
-				for (char const *s = cbuf;
-						 ((fs.prec_opt == NPF_FMT_SPEC_OPT_NONE) || (cbuf_len < fs.prec)) && *s;
-						 ++s, ++cbuf_len);
+			cbuf_len = (fs->prec_opt == NPF_FMT_SPEC_OPT_NONE) ?
+				(int)strlen(cbuf) : (int)strnlen(cbuf, (size_t)npf_max(0, fs->prec));
 #else
-				for (char const *s = cbuf; *s; ++s, ++cbuf_len); // strlen
-#endif
-			} break;
-
-			case NPF_FMT_SPEC_CONV_SIGNED_INT: {
-				npf_int_t val = 0;
-				switch (fs.length_modifier) {
-					NPF_EXTRACT(NONE, int, int);
-					NPF_EXTRACT(SHORT, short, int);
-					NPF_EXTRACT(LONG_DOUBLE, int, int);
-					NPF_EXTRACT(CHAR, char, int);
-					NPF_EXTRACT(LONG, long, long);
+			cbuf_len = (int)strlen(cbuf);
+#endif
+		} break;
+
+		case NPF_FMT_SPEC_CONV_SIGNED_INT: {
+			npf_int_t val = 0;
+			switch (fs->length_modifier) {
+				NPF_EXTRACT(NONE, int, int);
+				NPF_EXTRACT(SHORT, short, int);
+				NPF_EXTRACT(LONG_DOUBLE, int, int);
+				NPF_EXTRACT(CHAR, char, int);
+				NPF_EXTRACT(LONG, long, long);
 #if NANOPRINTF_USE_LARGE_FORMAT_SPECIFIERS == 1
-					NPF_EXTRACT(LARGE_LONG_LONG, long long, long long);
-					NPF_EXTRACT(LARGE_INTMAX, intmax_t, intmax_t);
-					NPF_EXTRACT(LARGE_SIZET, npf_ssize_t, npf_ssize_t);
-					NPF_EXTRACT(LARGE_PTRDIFFT, ptrdiff_t, ptrdiff_t);
+				NPF_EXTRACT(LARGE_LONG_LONG, long long, long long);
+				NPF_EXTRACT(LARGE_INTMAX, intmax_t, intmax_t);
+				NPF_EXTRACT(LARGE_SIZET, npf_ssize_t, npf_ssize_t);
+				NPF_EXTRACT(LARGE_PTRDIFFT, ptrdiff_t, ptrdiff_t);
 #endif
-					default: break;
-				}
+				default: break;
+			}
 
-				sign_c = (val < 0) ? '-' : fs.prepend;
+			sign_c = (val < 0) ? '-' : fs->prepend;
 
 #if NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 1
 #if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
-				zero = !val;
+			zero = !val;
 #endif
-				// special case, if prec and value are 0, skip
-				if (!val && (fs.prec_opt != NPF_FMT_SPEC_OPT_NONE) && !fs.prec) {
-					cbuf_len = 0;
-				} else
+			// special case, if prec and value are 0, skip
+			if (!val && (fs->prec_opt != NPF_FMT_SPEC_OPT_NONE) && !fs->prec) {
+				cbuf_len = 0;
+			} else
 #endif
-				{
-					npf_uint_t uval = (npf_uint_t)val;
-					if (val < 0) { uval = 0 - uval; }
-					cbuf_len = npf_utoa_rev(uval, cbuf, 10, fs.case_adjust);
-				}
-			} break;
+			{
+				npf_uint_t uval = (npf_uint_t)val;
+				if (val < 0) { uval = 0 - uval; }
+				cbuf_len = npf_utoa_rev(uval, cbuf, 10, fs->case_adjust);
+			}
+		} break;
 
 #if NANOPRINTF_USE_BINARY_FORMAT_SPECIFIERS == 1
-			case NPF_FMT_SPEC_CONV_BINARY:
-#endif
-			case NPF_FMT_SPEC_CONV_OCTAL:
-			case NPF_FMT_SPEC_CONV_HEX_INT:
-			case NPF_FMT_SPEC_CONV_UNSIGNED_INT: {
-				npf_uint_t val = 0;
-
-				switch (fs.length_modifier) {
-					NPF_EXTRACT(NONE, unsigned, unsigned);
-					NPF_EXTRACT(SHORT, unsigned short, unsigned);
-					NPF_EXTRACT(LONG_DOUBLE, unsigned, unsigned);
-					NPF_EXTRACT(CHAR, unsigned char, unsigned);
-					NPF_EXTRACT(LONG, unsigned long, unsigned long);
+		case NPF_FMT_SPEC_CONV_BINARY:
+#endif
+		case NPF_FMT_SPEC_CONV_OCTAL:
+		case NPF_FMT_SPEC_CONV_HEX_INT:
+		case NPF_FMT_SPEC_CONV_UNSIGNED_INT: {
+			npf_uint_t val = 0;
+
+			switch (fs->length_modifier) {
+				NPF_EXTRACT(NONE, unsigned, unsigned);
+				NPF_EXTRACT(SHORT, unsigned short, unsigned);
+				NPF_EXTRACT(LONG_DOUBLE, unsigned, unsigned);
+				NPF_EXTRACT(CHAR, unsigned char, unsigned);
+				NPF_EXTRACT(LONG, unsigned long, unsigned long);
 #if NANOPRINTF_USE_LARGE_FORMAT_SPECIFIERS == 1
-					NPF_EXTRACT(LARGE_LONG_LONG, unsigned long long, unsigned long long);
-					NPF_EXTRACT(LARGE_INTMAX, uintmax_t, uintmax_t);
-					NPF_EXTRACT(LARGE_SIZET, size_t, size_t);
-					NPF_EXTRACT(LARGE_PTRDIFFT, size_t, size_t);
+				NPF_EXTRACT(LARGE_LONG_LONG, unsigned long long, unsigned long long);
+				NPF_EXTRACT(LARGE_INTMAX, uintmax_t, uintmax_t);
+				NPF_EXTRACT(LARGE_SIZET, size_t, size_t);
+				NPF_EXTRACT(LARGE_PTRDIFFT, size_t, size_t);
 #endif
-					default: break;
-				}
+				default: break;
+			}
 
 #if NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 1
 #if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
-				zero = !val;
+			zero = !val;
 #endif
-				if (!val && (fs.prec_opt != NPF_FMT_SPEC_OPT_NONE) && !fs.prec) {
-					// Zero value and explicitly-requested zero precision means "print nothing".
-					if ((fs.conv_spec == NPF_FMT_SPEC_CONV_OCTAL) && fs.alt_form) {
-						fs.prec = 1; // octal special case, print a single '0'
-					}
-				} else
+			if (!val && (fs->prec_opt != NPF_FMT_SPEC_OPT_NONE) && !fs->prec) {
+				// Zero value and explicitly-requested zero precision means "print nothing".
+				if ((fs->conv_spec == NPF_FMT_SPEC_CONV_OCTAL) && fs->alt_form) {
+					fs->prec = 1; // octal special case, print a single '0'
+				}
+			} else
 #endif
 #if NANOPRINTF_USE_BINARY_FORMAT_SPECIFIERS == 1
-				if (fs.conv_spec == NPF_FMT_SPEC_CONV_BINARY) {
-					cbuf_len = npf_bin_len(val); u.binval = val;
-				} else
+			if (fs->conv_spec == NPF_FMT_SPEC_CONV_BINARY) {
+				cbuf_len = npf_bin_len(val); u.binval = val;
+			} else
 #endif
-				{
-					uint_fast8_t const base = (fs.conv_spec == NPF_FMT_SPEC_CONV_OCTAL) ?
-						8u : ((fs.conv_spec == NPF_FMT_SPEC_CONV_HEX_INT) ? 16u : 10u);
-					cbuf_len = npf_utoa_rev(val, cbuf, base, fs.case_adjust);
-				}
+			{
+				uint_fast8_t const base = (fs->conv_spec == NPF_FMT_SPEC_CONV_OCTAL) ?
+					8u : ((fs->conv_spec == NPF_FMT_SPEC_CONV_HEX_INT) ? 16u : 10u);
+				cbuf_len = npf_utoa_rev(val, cbuf, base, fs->case_adjust);
+			}
 
-				if (val && fs.alt_form && (fs.conv_spec == NPF_FMT_SPEC_CONV_OCTAL)) {
-					cbuf[cbuf_len++] = '0'; // OK to add leading octal '0' immediately.
-				}
+			if (val && fs->alt_form && (fs->conv_spec == NPF_FMT_SPEC_CONV_OCTAL)) {
+				cbuf[cbuf_len++] = '0'; // OK to add leading octal '0' immediately.
+			}
 
-				if (val && fs.alt_form) { // 0x or 0b but can't write it yet.
-					if (fs.conv_spec == NPF_FMT_SPEC_CONV_HEX_INT) { need_0x = 'X'; }
+			if (val && fs->alt_form) { // 0x or 0b but can't write it yet.
+				if (fs->conv_spec == NPF_FMT_SPEC_CONV_HEX_INT) { need_0x = 'X'; }
 #if NANOPRINTF_USE_BINARY_FORMAT_SPECIFIERS == 1
-					else if (fs.conv_spec == NPF_FMT_SPEC_CONV_BINARY) { need_0x = 'B'; }
+				else if (fs->conv_spec == NPF_FMT_SPEC_CONV_BINARY) { need_0x = 'B'; }
 #endif
-					if (need_0x) { need_0x += fs.case_adjust; }
-				}
-			} break;
+				if (need_0x) { need_0x += fs->case_adjust; }
+			}
+		} break;
 
-			case NPF_FMT_SPEC_CONV_POINTER: {
-				cbuf_len =
-					npf_utoa_rev((npf_uint_t)(uintptr_t)va_arg(args, void *), cbuf, 16, 'a' - 'A');
-				need_0x = 'x';
-			} break;
+		case NPF_FMT_SPEC_CONV_POINTER: {
+			cbuf_len =
+				npf_utoa_rev((npf_uint_t)(uintptr_t)va_arg(*args, void *), cbuf, 16, 'a' - 'A');
+			need_0x = 'x';
+		} break;
 
 #if NANOPRINTF_USE_WRITEBACK_FORMAT_SPECIFIERS == 1
-			case NPF_FMT_SPEC_CONV_WRITEBACK:
-				switch (fs.length_modifier) {
-					NPF_WRITEBACK(NONE, int);
-					NPF_WRITEBACK(SHORT, short);
-					NPF_WRITEBACK(LONG, long);
-					NPF_WRITEBACK(LONG_DOUBLE, double);
-					NPF_WRITEBACK(CHAR, signed char);
+		case NPF_FMT_SPEC_CONV_WRITEBACK:
+			switch (fs->length_modifier) {
+				NPF_WRITEBACK(NONE, int);
+				NPF_WRITEBACK(SHORT, short);
+				NPF_WRITEBACK(LONG, long);
+				NPF_WRITEBACK(LONG_DOUBLE, double);
+				NPF_WRITEBACK(CHAR, signed char);
 #if NANOPRINTF_USE_LARGE_FORMAT_SPECIFIERS == 1
-					NPF_WRITEBACK(LARGE_LONG_LONG, long long);
-					NPF_WRITEBACK(LARGE_INTMAX, intmax_t);
-					NPF_WRITEBACK(LARGE_SIZET, size_t);
-					NPF_WRITEBACK(LARGE_PTRDIFFT, ptrdiff_t);
+				NPF_WRITEBACK(LARGE_LONG_LONG, long long);
+				NPF_WRITEBACK(LARGE_INTMAX, intmax_t);
+				NPF_WRITEBACK(LARGE_SIZET, size_t);
+				NPF_WRITEBACK(LARGE_PTRDIFFT, ptrdiff_t);
 #endif
-					default: break;
-				} break;
+				default: break;
+			} break;
 #endif
 
 #if NANOPRINTF_USE_FLOAT_FORMAT_SPECIFIERS == 1
-			case NPF_FMT_SPEC_CONV_FLOAT_DEC:
-			case NPF_FMT_SPEC_CONV_FLOAT_SCI:
-			case NPF_FMT_SPEC_CONV_FLOAT_SHORTEST:
-			case NPF_FMT_SPEC_CONV_FLOAT_HEX: {
-				double val;
-				if (fs.length_modifier == NPF_FMT_SPEC_LEN_MOD_LONG_DOUBLE) {
-					val = (double)va_arg(args, long double);
-				} else {
-					val = va_arg(args, double);
-				}
+		case NPF_FMT_SPEC_CONV_FLOAT_DEC:
+		case NPF_FMT_SPEC_CONV_FLOAT_SCI:
+		case NPF_FMT_SPEC_CONV_FLOAT_SHORTEST:
+		case NPF_FMT_SPEC_CONV_FLOAT_HEX: {
+			double val;
+			if (fs->length_modifier == NPF_FMT_SPEC_LEN_MOD_LONG_DOUBLE) {
+				val = (double)va_arg(*args, long double);
+			} else {
+				val = va_arg(*args, double);
+			}
 
-				sign_c = (val < 0.) ? '-' : fs.prepend;
+#if NANOPRINTF_USE_EXACT_FLOAT_FORMAT_SPECIFIERS == 1
+			if (fs->conv_spec != NPF_FMT_SPEC_CONV_FLOAT_HEX) {
+				sign_c = npf_double_negative(val) ? '-' : fs->prepend;
+				cbuf = fbuf;
+				cbuf_len = npf_ftoa_exact(cbuf, (int)sizeof(fbuf), fs, val);
+				cbuf_forward = 1;
 #if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
-				zero = (val == 0.);
+				if ((val - val) != (val - val)) { fs->leading_zero_pad = 0; } // inf and nan pad with spaces
 #endif
-				cbuf_len = npf_ftoa_rev(cbuf, &fs, val);
-			} break;
+				break;
+			}
 #endif
-			default: break;
-		}
+			sign_c = (val < 0.) ? '-' : fs->prepend;
+#if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
+			zero = (val == 0.);
+#endif
+			cbuf_len = npf_ftoa_rev(cbuf, fs, val);
+		} break;
+#endif
+		default: break;
+	}
 
 #if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
-		// Compute the field width pad character
-		if (fs.field_width_opt != NPF_FMT_SPEC_OPT_NONE) {
-			if (fs.leading_zero_pad) { // '0' flag is only legal with numeric types
-				if ((fs.conv_spec != NPF_FMT_SPEC_CONV_STRING) &&
-						(fs.conv_spec != NPF_FMT_SPEC_CONV_CHAR) &&
-						(fs.conv_spec != NPF_FMT_SPEC_CONV_PERCENT)) {
+	// Compute the field width pad character
+	if (fs->field_width_opt != NPF_FMT_SPEC_OPT_NONE) {
+		if (fs->leading_zero_pad) { // '0' flag is only legal with numeric types
+			if ((fs->conv_spec != NPF_FMT_SPEC_CONV_STRING) &&
+					(fs->conv_spec != NPF_FMT_SPEC_CONV_CHAR) &&
+					(fs->conv_spec != NPF_FMT_SPEC_CONV_PERCENT)) {
 #if NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 1
-					if ((fs.prec_opt != NPF_FMT_SPEC_OPT_NONE) && !fs.prec && zero) {
-						pad_c = ' ';
-					} else
+				if ((fs->prec_opt != NPF_FMT_SPEC_OPT_NONE) && !fs->prec && zero) {
+					pad_c = ' ';
+				} else
 #endif
-					{ pad_c = '0'; }
-				}
-			} else { pad_c = ' '; }
-		}
+				{ pad_c = '0'; }
+			}
+		} else { pad_c = ' '; }
+	}
 #endif
 
-		// Compute the number of bytes to truncate or '0'-pad.
+	// Compute the number of bytes to truncate or '0'-pad.
 #if NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 1
-		if (fs.conv_spec != NPF_FMT_SPEC_CONV_STRING) {
+	if (fs->conv_spec != NPF_FMT_SPEC_CONV_STRING) {
 #if NANOPRINTF_USE_FLOAT_FORMAT_SPECIFIERS == 1
-			// float precision is after the decimal point
-			if (fs.conv_spec != NPF_FMT_SPEC_CONV_FLOAT_DEC)
+		// float precision is after the decimal point, or the count of significant digits
+		if ((fs->conv_spec != NPF_FMT_SPEC_CONV_FLOAT_DEC) && !cbuf_forward)
 #endif
-			{ prec_pad = npf_max(0, fs.prec - cbuf_len); }
-		}
+		{ prec_pad = npf_max(0, fs->prec - cbuf_len); }
+	}
 #endif
 
 #if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
-		// Given the full converted length, how many pad bytes?
-		field_pad = fs.field_width - cbuf_len - !!sign_c;
-		if (need_0x) { field_pad -= 2; }
+	// Given the full converted length, how many pad bytes?
+	field_pad = fs->field_width - cbuf_len - !!sign_c;
+	if (need_0x) { field_pad -= 2; }
 #if NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 1
-		field_pad -= prec_pad;
+	field_pad -= prec_pad;
 #endif
-		field_pad = npf_max(0, field_pad);
+	field_pad = npf_max(0, field_pad);
 
-		// Apply right-justified field width if requested
-		if (!fs.left_justified && pad_c) { // If leading zeros pad, sign goes first.
-			if (pad_c == '0') {
-				if (sign_c) { NPF_PUTC(sign_c); sign_c = 0; }
-				// Pad byte is '0', write '0x' before '0' pad chars.
-				if (need_0x) { NPF_PUTC('0'); NPF_PUTC(need_0x); }
-			}
-			while (field_pad-- > 0) { NPF_PUTC(pad_c); }
-			// Pad byte is ' ', write '0x' after ' ' pad chars but before number.
-			if ((pad_c != '0') && need_0x) { NPF_PUTC('0'); NPF_PUTC(need_0x); }
-		} else
+	// Apply right-justified field width if requested
+	if (!fs->left_justified && pad_c) { // If leading zeros pad, sign goes first.
+		if (pad_c == '0') {
+			if (sign_c) { NPF_PUTC(sign_c); sign_c = 0; }
+			// Pad byte is '0', write '0x' before '0' pad chars.
+			if (need_0x) { NPF_PUTC('0'); NPF_PUTC(need_0x); }
+		}
+		npf_out_fill(out, pad_c, field_pad);
+		// Pad byte is ' ', write '0x' after ' ' pad chars but before number.
+		if ((pad_c != '0') && need_0x) { NPF_PUTC('0'); NPF_PUTC(need_0x); }
+	} else
 #endif
-		{ if (need_0x) { NPF_PUTC('0'); NPF_PUTC(need_0x); } } // no pad, '0x' requested.
+	{ if (need_0x) { NPF_PUTC('0'); NPF_PUTC(need_0x); } } // no pad, '0x' requested.
 
-		// Write the converted payload
-		if (fs.conv_spec == NPF_FMT_SPEC_CONV_STRING) {
-			for (int i = 0; i < cbuf_len; ++i) { NPF_PUTC(cbuf[i]); }
-		} else {
-			if (sign_c) { NPF_PUTC(sign_c); }
+	// Write the converted payload
+	if (fs->conv_spec == NPF_FMT_SPEC_CONV_STRING) {
+		npf_out_write(out, cbuf, cbuf_len);
+	} else {
+		if (sign_c) { NPF_PUTC(sign_c); }
 #if NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS == 1
-			while (prec_pad-- > 0) { NPF_PUTC('0'); } // int precision leads.
+		npf_out_fill(out, '0', prec_pad); // int precision leads.
 #endif
 #if NANOPRINTF_USE_BINARY_FORMAT_SPECIFIERS == 1
-			if (fs.conv_spec == NPF_FMT_SPEC_CONV_BINARY) {
-				while (cbuf_len) { NPF_PUTC('0' + ((u.binval >> --cbuf_len) & 1)); }
-			} else
+		if (fs->conv_spec == NPF_FMT_SPEC_CONV_BINARY) {
+			while (cbuf_len) { NPF_PUTC('0' + ((u.binval >> --cbuf_len) & 1)); }
+		} else
 #endif
-			{ while (cbuf_len-- > 0) { NPF_PUTC(cbuf[cbuf_len]); } } // payload is reversed
+		if (cbuf_forward) {
+			npf_out_write(out, cbuf, cbuf_len);
+		} else {
+			npf_out_write_rev(out, cbuf, cbuf_len); // payload is reversed
 		}
+	}
 
 #if NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS == 1
-		if (fs.left_justified && pad_c) { // Apply left-justified field width
-			while (field_pad-- > 0) { NPF_PUTC(pad_c); }
-		}
+	if (fs->left_justified && pad_c) { // Apply left-justified field width
+		npf_out_fill(out, pad_c, field_pad);
+	}
 #endif
+}
+
+static int npf_vformat(npf_out_t *out, char const *format, va_list args) {
+	npf_format_spec_t fs;
+	char const *cur = format;
+	va_list ap;
+
+	va_copy(ap, args);
+	while (*cur) {
+		if (*cur != '%') { // Everything up to the next specifier in one go
+			size_t const run = strcspn(cur, "%");
+			npf_out_write(out, cur, (int)run);
+			cur += run;
+			continue;
+		}
+		int const fs_len = npf_parse_format_spec(cur, &fs);
+		if (!fs_len) { NPF_PUTC(*cur++); continue; }
+		cur += fs_len;
+		npf_convert(out, &fs, &ap);
 	}
+	va_end(ap);
 
-	return pc_cnt.n;
+	return out->n;
+}
+
+// A format parsed ahead of time: each entry is the literal run in front of a specifier
+// and the specifier, the last one being the literal tail (spec_len 0).
+typedef struct npf_compiled_spec {
+	uint16_t literal_len;
+	uint8_t spec_len;
+	npf_format_spec_t fs;
+} npf_compiled_spec_t;
+
+typedef struct npf_compiled_format {
+	int count;
+	npf_compiled_spec_t specs[NANOPRINTF_COMPILED_SPECS + 1];
+} npf_compiled_format_t;
+
+// Returns 0, or -1 if format has too many specifiers or too long literal runs.
+static int npf_compile_format(char const *format, npf_compiled_format_t *cf) {
+	char const *cur = format, *literal = format;
+	npf_format_spec_t fs;
+
+	cf->count = 0;
+	for (;;) {
+		cur += strcspn(cur, "%");
+		int const fs_len = *cur ? npf_parse_format_spec(cur, &fs) : 0;
+		if (*cur && !fs_len) { ++cur; continue; } // Printed as is, so part of the literal run
+		if ((cur - literal > UINT16_MAX) || (fs_len > UINT8_MAX) ||
+				(fs_len && (cf->count == NANOPRINTF_COMPILED_SPECS))) {
+			return -1;
+		}
+		npf_compiled_spec_t *s = &cf->specs[cf->count++];
+		s->literal_len = (uint16_t)(cur - literal);
+		s->spec_len = (uint8_t)fs_len;
+		if (!fs_len) { return 0; }
+		s->fs = fs;
+		cur += fs_len;
+		literal = cur;
+	}
+}
+
+static int npf_vformat_compiled(npf_out_t *out, char const *format,
+		npf_compiled_format_t const *cf, va_list args) {
+	char const *cur = format;
+	va_list ap;
+
+	va_copy(ap, args);
+	for (int i = 0; i < cf->count; ++i) {
+		npf_compiled_spec_t const *s = &cf->specs[i];
+		npf_out_write(out, cur, s->literal_len);
+		cur += s->literal_len + s->spec_len;
+		if (s->spec_len) {
+			npf_format_spec_t fs = s->fs; // Star-args write into it
+			npf_convert(out, &fs, &ap);
+		}
+	}
+	va_end(ap);
+
+	return out->n;
 }
 
 #undef NPF_PUTC
 #undef NPF_EXTRACT
 #undef NPF_WRITEBACK
 
+int npf_vpprintf(npf_putc pc, void *pc_ctx, char const *format, va_list args) {
+	npf_out_t out;
+	out.pc = pc;
+	out.pc_ctx = pc_ctx;
+	out.dst = NULL;
+	out.len = 0;
+	out.n = 0;
+	return npf_vformat(&out, format, args);
+}
+
 int npf_pprintf(npf_putc pc, void *pc_ctx, char const *format, ...) {
 	va_list val;
 	va_start(val, format);
@@ -1052,24 +1645,42 @@ int npf_snprintf(char *buffer, size_t bufsz, const char *format, ...) {
 	return rv;
 }
 
-int npf_vsnprintf(char *buffer, size_t bufsz, char const *format, va_list vlist) {
-	npf_bufputc_ctx_t bufputc_ctx;
-	bufputc_ctx.dst = buffer;
-	bufputc_ctx.len = bufsz;
-	bufputc_ctx.cur = 0;
-
-	npf_putc const pc = buffer ? npf_bufputc : npf_bufputc_nop;
-	int const n = npf_vpprintf(pc, &bufputc_ctx, format, vlist);
-	pc('\0', &bufputc_ctx);
-
+static void npf_terminate(char *buffer, size_t bufsz, int n) {
 	if (buffer && bufsz) {
 #ifdef NANOPRINTF_SNPRINTF_SAFE_EMPTY_STRING_ON_OVERFLOW
 		if (n >= (int)bufsz) { buffer[0] = '\0'; }
+		else { buffer[n] = '\0'; }
 #else
-		buffer[bufsz - 1] = '\0';
+		buffer[((size_t)n < bufsz) ? (size_t)n : (bufsz - 1)] = '\0';
 #endif
 	}
+}
+
+int npf_vsnprintf(char *buffer, size_t bufsz, char const *format, va_list vlist) {
+	npf_out_t out;
+	out.pc = NULL;
+	out.pc_ctx = NULL;
+	out.dst = buffer;
+	out.len = buffer ? bufsz : 0;
+	out.n = 0;
+
+	int const n = npf_vformat(&out, format, vlist);
+	npf_terminate(buffer, bufsz, n);
+	return n;
+}
 
+// npf_vsnprintf for a format npf_compile_format took, without parsing it again.
+static int npf_vsnprintf_compiled(char *buffer, size_t bufsz, char const *format,
+		npf_compiled_format_t const *cf, va_list vlist) {
+	npf_out_t out;
+	out.pc = NULL;
+	out.pc_ctx = NULL;
+	out.dst = buffer;
+	out.len = buffer ? bufsz : 0;
+	out.n = 0;
+
+	int const n = npf_vformat_compiled(&out, format, cf, vlist);
+	npf_terminate(buffer, bufsz, n);
 	return n;
 }
 
@@ -0,0 +1,105 @@
+#ifndef _SINK_H
+#define _SINK_H
+
+/* Internal interface between log.c and the output sinks. Not part of the public API. */
+
+#include <sys/uio.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define LINE_PREFIX_MAX 64		/* Room put_line_prefix may need in front of a message */
+#define DEFERRED_LINE_MAX 2048	/* Lines rendered from deferred records are cut to this, prefix included */
+
+/* Returns -1 if the async backend isn't running and the caller should writev(2) itself */
+/* MT-safe | AS-safe | AC-safe */
+int async_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/* Copies the line into the lmmap_start file if it's for stdout or stderr. Returns -1 if the mapped sink is off or fd isn't stdio */
+/* MT-safe | AS-safe | AC-safe */
+int mapped_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/* Returns -1 if per-thread buffering is off (or unusable right now) and the line should go to the next sink */
+/* MT-safe | AS-safe | AC-safe */
+int buffered_writev(int fd, int level, const struct iovec *iov, int iovcnt);
+
+/* Copies the line into a registered buffer and submits it to io_uring. Returns -1 if luring_start wasn't called (or the ring is full) */
+/* MT-safe | AS-safe | AC-safe */
+int uring_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/* Queues a record that binary_render turns into a line on the drainer. Returns -1 if the async backend isn't running */
+/* MT-safe | AS-safe | AC-safe */
+int async_write_deferred(int fd, const struct iovec *iov, int iovcnt);
+
+/* Records the call instead of formatting it. Returns -1 if binary mode is off (or can't take this call) and the line should be formatted */
+/* MT-safe | AS-safe | AC-safe */
+int binary_vlog(int fd, int level, int tag, const char *format, va_list ap);
+
+/* Whether lbinary_start is on, so lines must be handed over with their arguments rather than formatted */
+/* MT-safe | AS-safe | AC-safe */
+bool binary_enabled();
+
+/* Formats a record queued by async_write_deferred into out (size >= DEFERRED_LINE_MAX). Returns the line length and its start */
+/* MT-safe | AS-safe | AC-safe */
+int binary_render(const void *record, size_t len, char *out, char **start);
+
+/* Writes timestamp (of when, in the current mode) and log_tags[tag] so that they end right before end. Returns their length, at most LINE_PREFIX_MAX */
+/* MT-safe | AS-safe | AC-safe */
+int put_line_prefix(char *end, int tag, const struct timespec *when);
+
+#define TIMESTAMP_HAS_FRACTION(mode)	((mode) % 3 != 0)	/* LOG_TIMESTAMP_* modes with milli- or microseconds */
+
+/* Returns the LOG_TIMESTAMP_* mode, *gmtoff gets the offset from UTC in seconds lines are stamped with */
+/* MT-safe | AS-safe | AC-safe */
+int timestamp_settings(int *gmtoff);
+
+/* Tells if lasync_compress wants fd's lines, so they mustn't bypass the drainer */
+/* MT-safe | AS-safe | AC-safe */
+bool gzstream_requested(int fd);
+
+/* Compresses a drainer batch for stdout or stderr into gzip members. Returns -1 if lasync_compress is off or fd isn't stdio */
+/* MT-Unsafe race:drainer | AS-Unsafe heap | AC-Unsafe mem */
+int gzstream_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/* Called by the drainer on every loop: writes out a member that waited too long, or any unfinished one if finish is set */
+/* MT-Unsafe race:drainer | AS-Unsafe heap | AC-Unsafe mem */
+void gzstream_tick(bool finish);
+
+/* Passes the line unless lratelimit set a limit for level and format's call site used it up. Costs a relaxed load without a limit */
+/* MT-safe locale | AS-safe | AC-safe */
+bool ratelimit_allow(int level, const char *format);
+
+/* Returns -1 if ldedup_start is on and the line repeats fd's last one, else how often the line it replaces repeated (its level in *prev_level) */
+/* MT-safe | AS-safe | AC-safe */
+long dedup_line(int fd, int level, const char *format, const char *message, int len, int *prev_level);
+
+/* Writes a "Last line repeated count times" line to fd, which is stdout or stderr, past the duplicate check */
+/* MT-safe locale | AS-safe | AC-safe */
+void write_repeats(int fd, int level, unsigned long count);
+
+typedef struct FormatEntry FormatEntry;	/* A format parsed by formatcache.c */
+
+/* Returns format's cached parse if lformat_cache_start is on and it has one, else NULL. *tag gets the level of format's tag, LOG_NONE without one */
+/* MT-safe | AS-safe | AC-safe */
+const FormatEntry *format_lookup(const char *format, int *tag);
+
+/* npf_vsnprintf, taking format's specifiers from entry instead of parsing them if it isn't NULL */
+/* MT-safe locale | AS-safe | AC-safe */
+int format_vsnprintf(const FormatEntry *entry, char *buffer, size_t size, const char *format, va_list ap);
+
+/* Counts len bytes written to fd towards the size that triggers rotation */
+/* MT-safe | AS-safe | AC-safe */
+void rotate_account(int fd, size_t len);
+
+/* Reopens stdio_path() if lreopen() asked for it. Called before every line, costs a relaxed load otherwise */
+/* MT-safe | AS-safe | AC-Unsafe fd */
+void reopen_if_requested();
+
+/* The file redirect_stdio opened, NULL if stdio wasn't redirected to one */
+/* MT-safe | AS-safe | AC-safe */
+const char *stdio_path();
+
+/* Opens stdio_path() again and puts it over stdout and stderr. Writes in flight finish in the old file */
+/* MT-safe | AS-safe | AC-Unsafe fd */
+int reopen_stdio();
+
+#endif /* _SINK_H */
@@ -1,5 +1,6 @@
 #include <compiler.h>
 #include <log.h>
+#include <sink.h>
 #include <stdarg.h>
 #include <time.h>
 #include <stdint.h>
@@ -9,36 +10,50 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
-#define NANOPRINTF_VISIBILITY_STATIC
-#define NANOPRINTF_IMPLEMENTATION
-#include <nanoprintf.h>
+#include <strings.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <layout.h>
 
 /* <Configurable_values without code changes> */
 #define WARN_ON_OVERFLOW
 #define OVERFLOW_MSG "[DEBUG]: Log message truncated (overflow)\n"	/* Should have tag */
 #define LINE_BUF_SIZE 2048	/* Don't make too large, it's allocated on stack, possibly a few times. */
 #define DYNAMIC_LINE_SIZE	/* Dynamically determine line size. Slower. LINE_BUF_SIZE then used as a limit to not overflow stack */
+#define SINGLE_PASS_LINE_SIZE 256	/* With DYNAMIC_LINE_SIZE, format straight into a buffer of this size and measure only on overflow. Undefine to always measure first */
+//#define WRITEV_OUTPUT		/* Pass timestamp, tag and message to writev(2) as separate iovecs instead of putting the prefix in front of the message. Measured slower for short lines */
 #define GUARD_STACK			/* Allocate two more bytes than LINE_BUF_SIZE specifies... */
 #define GUARD_STACK_VALUE -1
 #define DEFAULT_LOG_LEVEL LOG_INFO
 /* </Configurable_values> */
 
-static const char *log_tags[] = {
-	[LOG_NONE] = "",
-	[LOG_ERROR] = LOG_ERROR_TAG,
-	[LOG_WARNING] = LOG_WARNING_TAG,
-	[LOG_INFO] = LOG_INFO_TAG,
-	[LOG_DEBUG] = LOG_DEBUG_TAG,
-	[LOG_REMOTE] = LOG_REMOTE_TAG
-};
-#define timestamp_size 26	/* Based on definition of asctime. Includes NULL byte */
 static bool redirected_stdio = false; 	/* If it wasn't redirected (yet), bypass log-like formatting */
-static atomic_int _timezone = 0;			/* Offset in hours from UTC */
-static int log_level = DEFAULT_LOG_LEVEL;
+static char stdio_file[PATH_MAX];		/* What redirect_stdio opened, empty if it fell back to /dev/null */
+static atomic_int _timezone = 0;			/* Offset in seconds from UTC */
+int _log_level = DEFAULT_LOG_LEVEL;		/* Plain int behind __atomic builtins, so log_enabled() in log.h works from C++ as well */
+static atomic_int configured_log_level = DEFAULT_LOG_LEVEL;	/* What setup_lstdio read from LOG_LEVEL, restored by the reload signal */
+static volatile sig_atomic_t cycle_signal;
+static atomic_int timestamp_mode = LOG_TIMESTAMP_ASCTIME;
+#define TIMESTAMP_CACHE_WORDS ((timestamp_size + 7) / 8)
+static struct {
+	atomic_uint seq;						/* Seqlock, odd while being updated */
+	atomic_llong rawtime;					/* Second the prefix was formatted for */
+	atomic_int gmtoff;						/* _timezone it was formatted with */
+	atomic_int mode;						/* timestamp_mode it was formatted with */
+	atomic_int len;							/* Excludes NULL byte */
+	atomic_ullong prefix[TIMESTAMP_CACHE_WORDS];	/* Timestamp, space and NULL byte. Fraction digits are zeros */
+} timestamp_cache = { .rawtime = -1 };
+#define line_headroom (timestamp_size - 1 + max_tag_size - 1)	/* Messages get formatted after this many bytes, the prefix is then put right before them */
 #ifdef WARN_ON_OVERFLOW
-static_assert(LINE_BUF_SIZE >= timestamp_size+MAX(LOG_TAG_SIZE(DEFAULT_LOG_LEVEL), sizeof(OVERFLOW_MSG))-1, "LINE_BUF_SIZE is below the minimal size required for safe operation (asctime_r, strcat, recursive call on buffer overflow)");
+static_assert(LINE_BUF_SIZE >= line_headroom+sizeof(OVERFLOW_MSG), "LINE_BUF_SIZE is below the minimal size required for safe operation (timestamp, tag, recursive call on buffer overflow)");
 #else
-static_assert(LINE_BUF_SIZE >= timestamp_size+LOG_TAG_SIZE(DEFAULT_LOG_LEVEL)-1, "LINE_BUF_SIZE is below the minimal size required for safe operation (asctime_r, strcat, recursive call on buffer overflow)");
+static_assert(LINE_BUF_SIZE > line_headroom, "LINE_BUF_SIZE is below the minimal size required for safe operation (timestamp, tag)");
+#endif
+static_assert(line_headroom <= LINE_PREFIX_MAX, "put_line_prefix callers only reserve LINE_PREFIX_MAX bytes");
+static_assert(line_headroom <= LOG_LINE_HEADROOM, "lline_write callers only reserve LOG_LINE_HEADROOM bytes");
+#ifdef SINGLE_PASS_LINE_SIZE
+static_assert(SINGLE_PASS_LINE_SIZE > line_headroom && SINGLE_PASS_LINE_SIZE <= LINE_BUF_SIZE, "SINGLE_PASS_LINE_SIZE must hold the line prefix and must not exceed LINE_BUF_SIZE");
 #endif
 
 #define check(...)								\
@@ -55,130 +70,122 @@ typedef enum {
 	SPECIAL
 } Action;
 
-/* Simple localtime implementation without locks, taken from https://sourceware.org/bugzilla/show_bug.cgi?id=16145 and slightly adapted */
-/* MT-safe AS-safe AC-safe */
-static void localtime_safe(time_t time, struct tm *tm_time)
-{
-	const char Days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-	uint32_t n32_Pass4year;
-	uint32_t n32_hpery;
-
-	tm_time->tm_gmtoff = atomic_load_explicit(&_timezone, memory_order_relaxed);
-	tm_time->tm_zone = "";
-	tm_time->tm_isdst = -1;
-	if (time < 0)
-		time = 0;
-	time = time + tm_time->tm_gmtoff;
-	tm_time->tm_wday = ((time / 86400) + 4) % 7;
-
-	tm_time->tm_sec = (int)(time % 60);
-	time /= 60;
-	tm_time->tm_min = (int)(time % 60);
-	time /= 60;
-	n32_Pass4year = ((unsigned int)time / (1461L * 24L));
-	tm_time->tm_year = (n32_Pass4year << 2) + 70;
-	time %= 1461L * 24L;
-	for (;;) {
-		n32_hpery = 365 * 24;
-		if ((tm_time->tm_year & 3) == 0)
-			n32_hpery += 24;
-		if (time < n32_hpery)
-			break;
-		tm_time->tm_year++;
-		time -= n32_hpery;
-	}
-	tm_time->tm_hour = (int)(time % 24);
-	time /= 24;
-	tm_time->tm_yday = time;
-	time++;
-	if ((tm_time->tm_year & 3) == 0) {
-		if (time > 60) {
-			time--;
-		}
-		else {
-			if (time == 60) {
-				tm_time->tm_mon = 1;
-				tm_time->tm_mday = 29;
-				return;
-			}
-		}
-	}
-	for (tm_time->tm_mon = 0; Days[tm_time->tm_mon] < time; tm_time->tm_mon++) {
-		time -= Days[tm_time->tm_mon];
-	}
+/* Copies the cached prefix, ending right before end, if it's for rawtime and mode. Fails instead of spinning while an update is in progress, so it stays AS-safe */
+/* MT-safe | AS-safe | AC-safe */
+static int load_cached_timestamp(time_t rawtime, int mode, char *end)
+{
+	union { uint64_t words[TIMESTAMP_CACHE_WORDS]; char chars[TIMESTAMP_CACHE_WORDS*8]; } copy;
+	unsigned int seq = atomic_load_explicit(&timestamp_cache.seq, memory_order_acquire);
+	int len;
 
-	tm_time->tm_mday = (int)(time);
-	return;
+	if (seq & 1)
+		return 0;
+	if (atomic_load_explicit(&timestamp_cache.rawtime, memory_order_relaxed) != rawtime ||
+		atomic_load_explicit(&timestamp_cache.mode, memory_order_relaxed) != mode ||
+		atomic_load_explicit(&timestamp_cache.gmtoff, memory_order_relaxed) != atomic_load_explicit(&_timezone, memory_order_relaxed))
+		return 0;
+	len = atomic_load_explicit(&timestamp_cache.len, memory_order_relaxed);
+	for (int i = 0; i < TIMESTAMP_CACHE_WORDS; i++)
+		copy.words[i] = atomic_load_explicit(&timestamp_cache.prefix[i], memory_order_relaxed);
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&timestamp_cache.seq, memory_order_relaxed) != seq)
+		return 0;
+	memcpy(end - len, copy.chars, len);
+	return len;
 }
 
+/* Publishes a freshly formatted prefix. Skipped if another thread (or an interrupted one) is already updating */
+/* MT-safe | AS-safe | AC-safe */
+static void store_cached_timestamp(time_t rawtime, int mode, const char *line_buffer, int len)
+{
+	union { uint64_t words[TIMESTAMP_CACHE_WORDS]; char chars[TIMESTAMP_CACHE_WORDS*8]; } copy;
+	unsigned int seq = atomic_load_explicit(&timestamp_cache.seq, memory_order_relaxed);
+
+	if (seq & 1 || !atomic_compare_exchange_strong_explicit(&timestamp_cache.seq, &seq, seq+1, memory_order_acquire, memory_order_relaxed))
+		return;
+	atomic_thread_fence(memory_order_release);
+	memcpy(copy.chars, line_buffer, len + 1);
+	for (int i = 0; i < TIMESTAMP_CACHE_WORDS; i++)
+		atomic_store_explicit(&timestamp_cache.prefix[i], copy.words[i], memory_order_relaxed);
+	atomic_store_explicit(&timestamp_cache.len, len, memory_order_relaxed);
+	atomic_store_explicit(&timestamp_cache.rawtime, rawtime, memory_order_relaxed);
+	atomic_store_explicit(&timestamp_cache.mode, mode, memory_order_relaxed);
+	atomic_store_explicit(&timestamp_cache.gmtoff, atomic_load_explicit(&_timezone, memory_order_relaxed), memory_order_relaxed);
+	atomic_store_explicit(&timestamp_cache.seq, seq+2, memory_order_release);
+}
+
+/* Writes the timestamp of now in the given mode and the space after it so that they end right before end. Returns their length */
+/* MT-safe | AS-safe | AC-safe */
+static int put_timestamp(char *end, const struct timespec *now, int mode)
+{
+	char fresh[timestamp_size];
+	int len;
+
+	len = load_cached_timestamp(now->tv_sec, mode, end);
+	if (unlikely(!len)) {
+		len = format_timestamp(now->tv_sec, mode, atomic_load_explicit(&_timezone, memory_order_relaxed), fresh);
+		store_cached_timestamp(now->tv_sec, mode, fresh, len);
+		memcpy(end - len, fresh, len);
+	}
+	put_timestamp_fraction(end - len, mode, now->tv_nsec);
+	return len;
+}
+
+/* Writes the current timestamp and the space after it so that they end right before end, the message usually being there. Returns their length */
 /* MT-safe locale | AS-safe | AC-safe */
-static int init_line_buffer(char *line_buffer, bool addDefaultTag)
+static int init_timestamp(char *end)
 {
-	time_t rawtime;
-	struct tm local_time;
-	
-	if (unlikely(time(&rawtime) == -1))
+	struct timespec now;
+	int mode = atomic_load_explicit(&timestamp_mode, memory_order_relaxed);
+
+	/* Both are served from the vDSO, the coarse clock being cheaper when only seconds are printed */
+	if (unlikely(clock_gettime(TIMESTAMP_HAS_FRACTION(mode) ? CLOCK_REALTIME : CLOCK_REALTIME_COARSE, &now) == -1))
 		return 0;
-	localtime_safe(rawtime, &local_time);
-	/* https://www.gnu.org/software/libc/manual/2.38/html_node/Formatting-Calendar-Time.html */
-	if (unlikely(!asctime_r(&local_time, line_buffer)))
-		strcpy(line_buffer, "Thu Jan 01 00:00:00 1970\n");
-	line_buffer[timestamp_size-2] = ' ';	/* Replace \n */
-	if (addDefaultTag) {
-		strcat(line_buffer, log_tags[DEFAULT_LOG_LEVEL]);
-		return timestamp_size + LOG_TAG_SIZE(DEFAULT_LOG_LEVEL) - 2;
-	}
-	return timestamp_size - 1;
+	return put_timestamp(end, &now, mode);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+int timestamp_settings(int *gmtoff)
+{
+	*gmtoff = atomic_load_explicit(&_timezone, memory_order_relaxed);
+	return atomic_load_explicit(&timestamp_mode, memory_order_relaxed);
 }
 
 /* MT-safe | AS-safe | AC-safe */
-static Action check_lprintf_format(const char *format)
+int put_line_prefix(char *end, int tag, const struct timespec *when)
 {
-	Action a;
+	char *start = end - log_tag_lengths[tag];
+
+	memcpy(start, log_tags[tag], log_tag_lengths[tag]);
+	return end - start + put_timestamp(start, when, atomic_load_explicit(&timestamp_mode, memory_order_relaxed));
+}
+
+/* *level gets the message's level, DEFAULT_LOG_LEVEL for untagged ones, *entry its cached parse if there is one */
+/* MT-safe | AS-safe | AC-safe */
+static Action check_lprintf_format(const char *format, const FormatEntry **entry, int *level)
+{
+	int tag;
 
 	/* 
 	 * DEFAULT - to stdout_fileno
 	 * SPECIAL - to stderr_fileno
 	*/
 
-	if (format[0] != '[')
-		a = FALLBACK;
-	else switch(format[1]) {
-		case 'D':
-			a = SPECIAL;
-			if (log_level < LOG_DEBUG)
-				a = ABORT;
-			break;
-		case 'I':
-			a = DEFAULT;
-			if (log_level < LOG_INFO)
-				a = ABORT;
-			break;
-		case 'W':
-			a = SPECIAL;
-			if (log_level < LOG_WARNING)
-				a = ABORT;
-			break;
-		case 'E':
-			a = SPECIAL;
-			if (log_level < LOG_ERROR)
-				a = ABORT;
-			break;
-		case 'R':	/* Message from remote peer */
-			a = DEFAULT;
-			break;
+	*entry = format_lookup(format, &tag);
+	*level = tag;
+	switch (tag) {
+		case LOG_DEBUG:
+		case LOG_WARNING:
+		case LOG_ERROR:
+			return get_log_level() < tag ? ABORT : SPECIAL;
+		case LOG_INFO:
+			return get_log_level() < tag ? ABORT : DEFAULT;
+		case LOG_REMOTE:	/* Message from remote peer */
+			return DEFAULT;
 		default:
-			a = FALLBACK;
+			*level = DEFAULT_LOG_LEVEL;
+			return FALLBACK;
 	}
-	
-	return a;
-}
-
-/* POSIX.1-2008/SUSv4 Section XSI 2.9.7 ("Thread Interactions with Regular File Operations") -> write(2) is atomic on regular files */
-/* MT-safe | AS-safe | AC-safe */
-inline int simple_write(int fd, const char *buf)
-{
-	return write(fd, buf, strlen(buf));
 }
 
 /* MT-safe locale | AS-safe | AC-safe */
@@ -241,64 +248,135 @@ int lfprintf(FILE *stream, const char *format, ...)
 #define CHECK_STACK(buf_name)
 #endif
 
-/* stream == NULL for default stream based on tag */
+/* MT-safe | AS-safe | AC-safe */
+static inline int line_fd(FILE *stream, Action a)
+{
+	if (stream)
+		return fileno(stream);
+	return a == SPECIAL ? STDERR_FILENO : STDOUT_FILENO;
+}
+
+static const char repeat_format[] = "Last line repeated %lu times\n";
+static int lvfprintf_tagged(FILE *stream, Action a, int level, int tag, const FormatEntry *entry, const char *format, va_list ap);
+
+/*
+ * Sends timestamp, log_tags[tag] and the message (len bytes at line_buffer+line_headroom, truncated to fit) in one syscall.
+ * POSIX.1-2008/SUSv4 Section XSI 2.9.7 ("Thread Interactions with Regular File Operations") -> write(2) and writev(2) are atomic on regular files.
+ * The prefix is written into the headroom in front of the message, so neither the message nor the prefix get copied around.
+ */
 /* MT-safe locale | AS-safe | AC-safe */
-int lvfprintf(FILE *stream, const char *format, va_list ap)
+static int write_line(FILE *stream, Action a, int level, int tag, const char *format, char *line_buffer, int line_buffer_size, int len)
 {
-	int ret, olderrno = errno;
-	Action a = check_lprintf_format(format);
-	
-	if (a == ABORT)
-		return 0;
-	if (a == FALLBACK && log_level < DEFAULT_LOG_LEVEL)
-		return 0;
-	#ifdef DYNAMIC_LINE_SIZE
-		va_list ptr;
-		va_copy(ptr, ap);
-		if (a == FALLBACK)
-			ret = npf_vsnprintf(NULL, 0, format, ptr)+timestamp_size+LOG_TAG_SIZE(DEFAULT_LOG_LEVEL)-1;
-		else
-			ret = npf_vsnprintf(NULL, 0, format, ptr)+timestamp_size-1;
-		ALLOCATE_BUFFER(line_buffer, ret);
-		va_end(ptr);
-	#else
-		ALLOCATE_FIXED_BUFFER(line_buffer);
-	#endif
-	if (a == FALLBACK) {
-		if (log_level < DEFAULT_LOG_LEVEL)
-			return 0;
-		ret = init_line_buffer(line_buffer, true);
-	}
-	else {
-		ret = init_line_buffer(line_buffer, false);
-	}
+	char *message = line_buffer + line_headroom;
+	struct iovec iov[3];
+	int fd, ret, prev_level, iovcnt = 0;
+	long repeats;
 
-	ret = npf_vsnprintf(line_buffer+ret, line_buffer_size-ret, format, ap);
 	#ifdef WARN_ON_OVERFLOW
-		if (ret > line_buffer_size-ret-1)
+		if (unlikely(len > line_buffer_size-line_headroom-1))
 			lprintf(OVERFLOW_MSG);
 	#endif
+	len = min(len, line_buffer_size-line_headroom-1);
+
+	fd = line_fd(stream, a);
+	if (format != repeat_format) {
+		repeats = dedup_line(fd, level, format, message, len, &prev_level);
+		if (unlikely(repeats < 0))
+			return len;
+		if (unlikely(repeats))
+			write_repeats(fd, prev_level, repeats);
+	}
 
-	if (stream) {
-		#ifdef DYNAMIC_LINE_SIZE
-			ret = write(fileno(stream), line_buffer, line_buffer_size);
+	#ifdef WRITEV_OUTPUT
+		char timestamp[timestamp_size];
+		iov[iovcnt].iov_len = init_timestamp(timestamp + timestamp_size);
+		iov[iovcnt].iov_base = timestamp + timestamp_size - iov[iovcnt].iov_len;
+		iovcnt++;
+		if (tag != LOG_NONE) {
+			iov[iovcnt].iov_base = (char *)log_tags[tag];
+			iov[iovcnt++].iov_len = log_tag_lengths[tag];
+		}
+		iov[iovcnt].iov_base = message;
+		iov[iovcnt++].iov_len = len;
+	#else
+		char *start = message - log_tag_lengths[tag];
+		memcpy(start, log_tags[tag], log_tag_lengths[tag]);
+		start -= init_timestamp(start);
+		iov[iovcnt].iov_base = start;
+		iov[iovcnt++].iov_len = message + len - start;
+	#endif
+
+	ret = mapped_writev(fd, iov, iovcnt);
+	if (likely(ret < 0))
+		ret = buffered_writev(fd, level, iov, iovcnt);
+	if (likely(ret < 0))
+		ret = async_writev(fd, iov, iovcnt);
+	if (likely(ret < 0))
+		ret = uring_writev(fd, iov, iovcnt);
+	if (likely(ret < 0)) {
+		#ifdef WRITEV_OUTPUT
+			ret = writev(fd, iov, iovcnt);
 		#else
-			ret = simple_write(fileno(stream), line_buffer)
+			ret = write(fd, iov[0].iov_base, iov[0].iov_len);
 		#endif
+		if (likely(ret > 0))
+			rotate_account(fd, ret);
 	}
-	else {
+	return ret;
+}
+
+#if defined(DYNAMIC_LINE_SIZE) && defined(SINGLE_PASS_LINE_SIZE)
+/* Second pass for lines that didn't fit into SINGLE_PASS_LINE_SIZE. Kept out of line so the common case doesn't reserve its stack */
+/* MT-safe locale | AS-safe | AC-safe */
+static __attribute__((noinline)) int lvfprintf_overflow(FILE *stream, Action a, int level, int tag, const FormatEntry *entry, const char *format, va_list ap, int line_size)
+{
+	int ret;
+	ALLOCATE_BUFFER(line_buffer, line_size);
+
+	ret = format_vsnprintf(entry, line_buffer+line_headroom, line_buffer_size-line_headroom, format, ap);
+	ret = write_line(stream, a, level, tag, format, line_buffer, line_buffer_size, ret);
+
+	CHECK_STACK(line_buffer);
+	return ret;
+}
+#endif
+
+/* Writes timestamp, log_tags[tag] and the formatted message of the given level to the stream chosen by a. entry is format_lookup's for format */
+/* MT-safe locale | AS-safe | AC-safe */
+static int lvfprintf_tagged(FILE *stream, Action a, int level, int tag, const FormatEntry *entry, const char *format, va_list ap)
+{
+	int ret, olderrno = errno;
+
+	reopen_if_requested();
+	ret = binary_vlog(line_fd(stream, a), level, tag, format, ap);
+	if (unlikely(ret >= 0)) {
+		errno = olderrno;
+		return ret;
+	}
+
+	#if defined(DYNAMIC_LINE_SIZE) && defined(SINGLE_PASS_LINE_SIZE)
+		va_list retry;
+		va_copy(retry, ap);
+		ALLOCATE_BUFFER(line_buffer, SINGLE_PASS_LINE_SIZE);
+		ret = format_vsnprintf(entry, line_buffer+line_headroom, line_buffer_size-line_headroom, format, ap);
+		if (unlikely(ret > line_buffer_size-line_headroom-1))
+			ret = lvfprintf_overflow(stream, a, level, tag, entry, format, retry, line_headroom+ret+1);
+		else
+			ret = write_line(stream, a, level, tag, format, line_buffer, line_buffer_size, ret);
+		va_end(retry);
+	#else
 		#ifdef DYNAMIC_LINE_SIZE
-			if (a == SPECIAL)
-				ret = write(STDERR_FILENO, line_buffer, line_buffer_size);
-			else
-				ret = write(STDOUT_FILENO, line_buffer, line_buffer_size);
+			va_list ptr;
+			va_copy(ptr, ap);
+			ret = line_headroom+format_vsnprintf(entry, NULL, 0, format, ptr)+1;
+			ALLOCATE_BUFFER(line_buffer, ret);
+			va_end(ptr);
 		#else
-			if (a == SPECIAL)
-				ret = simple_write(STDERR_FILENO, line_buffer);
-			else
-				ret = simple_write(STDOUT_FILENO, line_buffer);
+			ALLOCATE_FIXED_BUFFER(line_buffer);
 		#endif
-	}
+		ret = format_vsnprintf(entry, line_buffer+line_headroom, line_buffer_size-line_headroom, format, ap);
+		ret = write_line(stream, a, level, tag, format, line_buffer, line_buffer_size, ret);
+	#endif
 
 	CHECK_STACK(line_buffer);
 	errno = olderrno;
@@ -306,30 +384,191 @@ int lvfprintf(FILE *stream, const char *format, va_list ap)
 }
 
 /* MT-safe locale | AS-safe | AC-safe */
-void lperrorf(const char *format, ...)
+static int repeats_line(int fd, int level, const char *format, ...)
+{
+	va_list ptr;
+	int ret, tag;
+	const FormatEntry *entry = format_lookup(format, &tag);
+
+	va_start(ptr, format);
+	ret = lvfprintf_tagged(NULL, fd == STDERR_FILENO ? SPECIAL : DEFAULT, level, level, entry, format, ptr);
+	va_end(ptr);
+
+	return ret;
+}
+
+/* MT-safe locale | AS-safe | AC-safe */
+void write_repeats(int fd, int level, unsigned long count)
+{
+	repeats_line(fd, level, repeat_format, count);
+}
+
+/* stream == NULL for default stream based on tag */
+/* MT-safe locale | AS-safe | AC-safe */
+int lvfprintf(FILE *stream, const char *format, va_list ap)
+{
+	const FormatEntry *entry;
+	int level;
+	Action a = check_lprintf_format(format, &entry, &level);
+
+	if (a == ABORT || (a == FALLBACK && get_log_level() < DEFAULT_LOG_LEVEL))
+		return 0;
+	if (!ratelimit_allow(level, format))
+		return 0;
+	if (a == FALLBACK)
+		return lvfprintf_tagged(stream, a, level, DEFAULT_LOG_LEVEL, entry, format, ap);
+	return lvfprintf_tagged(stream, a, level, LOG_NONE, entry, format, ap);
+}
+
+/* Same as lvfprintf, but the level comes as an integer and its tag is added, so format mustn't start with one */
+/* MT-safe locale | AS-safe | AC-safe */
+int lvlfprintf(FILE *stream, int level, const char *format, va_list ap)
+{
+	const FormatEntry *entry;
+	int tag;
+
+	if (unlikely(level <= LOG_NONE || level > LOG_REMOTE))
+		return 0;
+	if (!log_enabled(level) || !ratelimit_allow(level, format))
+		return 0;
+	entry = format_lookup(format, &tag);
+	return lvfprintf_tagged(stream, (level == LOG_INFO || level == LOG_REMOTE) ? DEFAULT : SPECIAL, level, level, entry, format, ap);
+}
+
+/* MT-safe locale | AS-safe | AC-safe */
+int llprintf(int level, const char *format, ...)
+{
+	va_list ptr;
+	int ret;
+
+	va_start(ptr, format);
+	ret = lvlfprintf(NULL, level, format, ptr);
+	va_end(ptr);
+
+	return ret;
+}
+
+/* Action for a line of level, whose tag gets added unless it's LOG_NONE. LOG_NONE as level means an untagged lprintf line */
+/* MT-safe | AS-safe | AC-safe */
+static Action line_action(int *level, int *tag)
+{
+	if (*level == LOG_NONE) {
+		*level = *tag = DEFAULT_LOG_LEVEL;
+		return FALLBACK;
+	}
+	return (*level == LOG_INFO || *level == LOG_REMOTE) ? DEFAULT : SPECIAL;
+}
+
+/* MT-safe locale | AS-safe | AC-safe */
+int lline_begin(int level, const char *format)
+{
+	if (level == LOG_NONE)
+		level = DEFAULT_LOG_LEVEL;
+	if (!log_enabled(level) || !ratelimit_allow(level, format))
+		return 0;
+	reopen_if_requested();
+	return binary_enabled() ? -1 : 1;
+}
+
+/* MT-safe locale | AS-safe | AC-safe */
+int lline_write(FILE *stream, int level, int tag, const char *format, char *message, int size, int len)
 {
 	int ret, olderrno = errno;
+	Action a = line_action(&level, &tag);
+
+	ret = write_line(stream, a, level, tag, format, message - line_headroom, line_headroom + size, len);
+	errno = olderrno;
+	return ret;
+}
+
+/* MT-safe locale | AS-safe | AC-safe */
+int lline_printf(FILE *stream, int level, int tag, const char *format, ...)
+{
 	va_list ptr;
+	int ret, cached_tag;
+	const FormatEntry *entry = format_lookup(format, &cached_tag);
+	Action a = line_action(&level, &tag);
 
-	if (log_level < LOG_ERROR)
-		return;
+	va_start(ptr, format);
+	ret = lvfprintf_tagged(stream, a, level, tag, entry, format, ptr);
+	va_end(ptr);
 
-	#ifdef DYNAMIC_LINE_SIZE
-		va_start(ptr, format);
-		ALLOCATE_BUFFER(error_message, npf_vsnprintf(NULL, 0, format, ptr));
-		va_end(ptr);
-	#else
-		ALLOCATE_FIXED_BUFFER(error_message);
-	#endif
+	return ret;
+}
+
+/* lprintf for lperrorf's line, without the rate limiter that already let the caller's format through */
+/* MT-safe locale | AS-safe | AC-safe */
+static void lperrorf_line(const char *format, ...)
+{
+	va_list ptr;
+	int tag;
+	const FormatEntry *entry = format_lookup(format, &tag);
 
 	va_start(ptr, format);
-	ret = npf_vsnprintf(error_message, error_message_size, format, ptr);
+	lvfprintf_tagged(NULL, SPECIAL, LOG_ERROR, LOG_NONE, entry, format, ptr);
 	va_end(ptr);
+}
+
+#if defined(DYNAMIC_LINE_SIZE) && defined(SINGLE_PASS_LINE_SIZE)
+/* MT-safe locale | AS-safe | AC-safe */
+static __attribute__((noinline)) void lperrorf_overflow(int errnum, const FormatEntry *entry, const char *format, va_list ap, int message_size)
+{
+	int ret;
+	ALLOCATE_BUFFER(error_message, message_size);
+
+	ret = format_vsnprintf(entry, error_message, error_message_size, format, ap);
 	#ifdef WARN_ON_OVERFLOW
 		if (ret > error_message_size-1)
 			lprintf(OVERFLOW_MSG);
 	#endif
-	lprintf("[ERROR]: %s: %s\n", error_message, strerrordesc_np(olderrno));
+	lperrorf_line("[ERROR]: %s: %s\n", error_message, strerrordesc_np(errnum));
+
+	CHECK_STACK(error_message);
+}
+#endif
+
+/* MT-safe locale | AS-safe | AC-safe */
+void lperrorf(const char *format, ...)
+{
+	int ret, tag, olderrno = errno;
+	const FormatEntry *entry;
+	va_list ptr;
+
+	if (get_log_level() < LOG_ERROR || !ratelimit_allow(LOG_ERROR, format))
+		return;
+	entry = format_lookup(format, &tag);
+
+	#if defined(DYNAMIC_LINE_SIZE) && defined(SINGLE_PASS_LINE_SIZE)
+		ALLOCATE_BUFFER(error_message, SINGLE_PASS_LINE_SIZE);
+		va_start(ptr, format);
+		ret = format_vsnprintf(entry, error_message, error_message_size, format, ptr);
+		va_end(ptr);
+		if (unlikely(ret > error_message_size-1)) {
+			va_start(ptr, format);
+			lperrorf_overflow(olderrno, entry, format, ptr, ret+1);
+			va_end(ptr);
+			CHECK_STACK(error_message);
+			errno = olderrno;
+			return;
+		}
+	#else
+		#ifdef DYNAMIC_LINE_SIZE
+			va_start(ptr, format);
+			ALLOCATE_BUFFER(error_message, format_vsnprintf(entry, NULL, 0, format, ptr)+1);
+			va_end(ptr);
+		#else
+			ALLOCATE_FIXED_BUFFER(error_message);
+		#endif
+
+		va_start(ptr, format);
+		ret = format_vsnprintf(entry, error_message, error_message_size, format, ptr);
+		va_end(ptr);
+		#ifdef WARN_ON_OVERFLOW
+			if (ret > error_message_size-1)
+				lprintf(OVERFLOW_MSG);
+		#endif
+	#endif
+	lperrorf_line("[ERROR]: %s: %s\n", error_message, strerrordesc_np(olderrno));
 
 	CHECK_STACK(error_message);
 	errno = olderrno;
@@ -347,40 +586,155 @@ void update_timezone()
 		atomic_store_explicit(&_timezone, local_time.tm_gmtoff, memory_order_relaxed);
 }
 
+/* MT-safe | AS-safe | AC-safe */
+void set_timestamp_mode(int mode)
+{
+	if (mode >= LOG_TIMESTAMP_ASCTIME && mode <= LOG_TIMESTAMP_ISO8601_US)
+		atomic_store_explicit(&timestamp_mode, mode, memory_order_relaxed);
+}
+
+/* MT-Safe env locale | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+static void setup_timestamp_mode()
+{
+	static const char *names[] = {
+		[LOG_TIMESTAMP_ASCTIME] = "ASCTIME",
+		[LOG_TIMESTAMP_ASCTIME_MS] = "ASCTIME_MS",
+		[LOG_TIMESTAMP_ASCTIME_US] = "ASCTIME_US",
+		[LOG_TIMESTAMP_ISO8601] = "ISO8601",
+		[LOG_TIMESTAMP_ISO8601_MS] = "ISO8601_MS",
+		[LOG_TIMESTAMP_ISO8601_US] = "ISO8601_US"
+	};
+	char *timestamp_str = getenv("LOG_TIMESTAMP");
+
+	if (!timestamp_str)
+		return;
+	for (int mode = LOG_TIMESTAMP_ASCTIME; mode <= LOG_TIMESTAMP_ISO8601_US; mode++) {
+		if (!strcasecmp(timestamp_str, names[mode])) {
+			set_timestamp_mode(mode);
+			return;
+		}
+	}
+	lprintf("[WARNING]: Unknown LOG_TIMESTAMP value. Using the default value: ASCTIME.\n");
+}
+
 /* MT-Safe env locale | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
 void setup_lstdio()
 {
 	char *log_level_str;
+	int level = get_log_level();
 
+	setup_timestamp_mode();
 	update_timezone();
 	log_level_str = getenv("LOG_LEVEL");
 	if (log_level_str) {
 		switch (log_level_str[0]) {
 			case 'N':
 			case 'n':
-				log_level = LOG_NONE;
+				level = LOG_NONE;
 				break;
 			case 'E':
 			case 'e':
-				log_level = LOG_ERROR;
+				level = LOG_ERROR;
 				break;
 			case 'W':
 			case 'w':
-				log_level = LOG_WARNING;
+				level = LOG_WARNING;
 				break;
 			case 'I':
 			case 'i':
-				log_level = LOG_INFO;
+				level = LOG_INFO;
 				break;
 			case 'D':
 			case 'd':
-				log_level = LOG_DEBUG;
+				level = LOG_DEBUG;
 				break;
 			default:
-				log_level = DEFAULT_LOG_LEVEL;
+				level = DEFAULT_LOG_LEVEL;
 				lprintf("[WARNING]: Unknown LOG_LEVEL value. Using the default value: LOG_WARNING.\n");
 		}
 	}
+	atomic_store_explicit(&configured_log_level, level, memory_order_relaxed);
+	set_log_level(level);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+void set_log_level(int level)
+{
+	if (level >= LOG_NONE && level <= LOG_DEBUG)
+		__atomic_store_n(&_log_level, level, __ATOMIC_RELAXED);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static void log_level_signal_handler(int signum)
+{
+	static const char *names[] = {
+		[LOG_NONE] = "NONE",
+		[LOG_ERROR] = "ERROR",
+		[LOG_WARNING] = "WARNING",
+		[LOG_INFO] = "INFO",
+		[LOG_DEBUG] = "DEBUG"
+	};
+	int level;
+
+	if (signum == cycle_signal) {
+		level = get_log_level();
+		while (!__atomic_compare_exchange_n(&_log_level, &level, level < LOG_DEBUG ? level + 1 : LOG_NONE, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+		level = level < LOG_DEBUG ? level + 1 : LOG_NONE;
+	}
+	else {
+		level = atomic_load_explicit(&configured_log_level, memory_order_relaxed);
+		set_log_level(level);
+	}
+	llprintf(LOG_REMOTE, "Log level set to %s\n", names[level]);
+}
+
+/* 0 leaves a signal alone */
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+int setup_log_level_signals(int cycle_signum, int reload_signum)
+{
+	struct sigaction sa = { .sa_handler = log_level_signal_handler, .sa_flags = SA_RESTART };
+
+	sigemptyset(&sa.sa_mask);
+	if (cycle_signum)
+		sigaddset(&sa.sa_mask, cycle_signum);
+	if (reload_signum)
+		sigaddset(&sa.sa_mask, reload_signum);
+	cycle_signal = cycle_signum;
+	if (cycle_signum && sigaction(cycle_signum, &sa, NULL) < 0) {
+		dlperror("sigaction");
+		return -1;
+	}
+	if (reload_signum && sigaction(reload_signum, &sa, NULL) < 0) {
+		dlperror("sigaction");
+		return -1;
+	}
+	return 0;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+const char *stdio_path()
+{
+	return stdio_file[0] ? stdio_file : NULL;
+}
+
+/* MT-safe | AS-safe | AC-Unsafe fd */
+int reopen_stdio()
+{
+	int fd;
+
+	if (!stdio_file[0]) {
+		errno = ENOENT;
+		return -1;
+	}
+	fd = open(stdio_file, O_CREAT | O_RDWR | O_APPEND | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -1;
+	/* dup2 swaps each descriptor atomically, so a concurrent write goes entirely to one file or the other */
+	check( dup2(fd, STDOUT_FILENO) )
+	check( dup2(fd, STDERR_FILENO) )
+	if (likely(fd > STDERR_FILENO))
+		check( close(fd) )
+	return 0;
 }
 
 void redirect_stdio(char *log_path)
@@ -394,6 +748,15 @@ void redirect_stdio(char *log_path)
 		lprintf("[WARNING]: Cannot open %s\n", log_path);
 		lprintf("[WARNING]: No logging functionality present.\n");
 		fd = nullfd;
+		stdio_file[0] = '\0';
+	}
+	else if (strlen(log_path) < sizeof(stdio_file))
+		strcpy(stdio_file, log_path);
+	else {
+		/* Still logs to it, but it can't be reopened or rotated */
+		errno = ENAMETOOLONG;
+		dlperror("redirect_stdio");
+		stdio_file[0] = '\0';
 	}
 	check( dup2(nullfd, STDIN_FILENO) )
 	check( dup2(fd, STDOUT_FILENO) )
@@ -0,0 +1,220 @@
+#include <compiler.h>
+#include <log.h>
+#include <sink.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* <Configurable_values without code changes> */
+#define MAPPED_MIN_EXTENT (1 << 20)
+#define MAPPED_MAX_SIZE (1ull << 40)	/* Address space reserved up front, lines past it get dropped */
+/* </Configurable_values> */
+
+/*
+ * Lines for stdout and stderr get copied into a shared mapping of the file. A writer reserves its
+ * bytes with a fetch_add on reserved and copies the line, with no syscall unless the reservation
+ * runs past the mapped extents: then one writer fallocates and maps the next extent in place,
+ * inside address space reserved at start, while the others wait for it.
+ * The file ends in zeros up to the extent boundary until lmmap_stop (or exit) truncates it to the
+ * reserved length. After a crash, lmmap_start cuts the file after its last newline, removing the
+ * zero fill and any half-copied last line. Lines reserved but not fully copied before the crash
+ * stay in the file as runs of NUL bytes, which readers should treat as damaged and skip.
+ */
+static atomic_bool mapping;
+static atomic_int in_flight;			/* Writers that may be copying into the mapping */
+static atomic_ullong reserved;			/* File offset of the next line */
+static atomic_ullong mapped;			/* Bytes of the file that are mapped and allocated */
+static atomic_bool growing;
+static atomic_ulong dropped_lines;
+static char *base;					/* File offset 0, only extents from map_start on are mapped */
+static unsigned long long map_start;
+static int map_fd = -1;
+static size_t extent;
+static pthread_once_t mapped_once = PTHREAD_ONCE_INIT;
+static __thread bool is_grower __attribute__((tls_model("initial-exec")));
+
+/* Maps extents until end is covered. Returns -1 if end can't be reached */
+/* MT-safe | AS-safe | AC-Unsafe fd */
+static int grow(unsigned long long end)
+{
+	while (atomic_load_explicit(&mapped, memory_order_acquire) < end) {
+		bool expected = false;
+		unsigned long long from;
+
+		if (end > MAPPED_MAX_SIZE)
+			return -1;
+		if (!atomic_compare_exchange_weak(&growing, &expected, true)) {
+			/* A signal handler interrupting the grower would wait for itself */
+			if (is_grower)
+				return -1;
+			sched_yield();
+			continue;
+		}
+		is_grower = true;
+		from = atomic_load(&mapped);
+		if (from < end) {
+			/* Allocating first means a full disk shows up here, not as SIGBUS on a store */
+			if (fallocate(map_fd, 0, from, extent) < 0 ||
+				mmap(base + from, extent, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, map_fd, from) == MAP_FAILED) {
+				is_grower = false;
+				atomic_store(&growing, false);
+				return -1;
+			}
+			atomic_store_explicit(&mapped, from + extent, memory_order_release);
+		}
+		is_grower = false;
+		atomic_store(&growing, false);
+	}
+	return 0;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+int mapped_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	unsigned long long offset;
+	size_t len = 0;
+
+	if (likely(!atomic_load_explicit(&mapping, memory_order_relaxed)))
+		return -1;
+	if (fd != STDOUT_FILENO && fd != STDERR_FILENO)
+		return -1;
+	atomic_fetch_add(&in_flight, 1);
+	if (!atomic_load(&mapping)) {
+		atomic_fetch_sub(&in_flight, 1);
+		return -1;
+	}
+
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	offset = atomic_fetch_add_explicit(&reserved, len, memory_order_relaxed);
+	if (unlikely(offset + len > atomic_load_explicit(&mapped, memory_order_acquire)) && grow(offset + len) < 0) {
+		/* The reserved bytes stay zero, just like a line lost in a crash */
+		atomic_fetch_add(&dropped_lines, 1);
+		atomic_fetch_sub(&in_flight, 1);
+		return len;
+	}
+	for (int i = 0; i < iovcnt; i++) {
+		memcpy(base + offset, iov[i].iov_base, iov[i].iov_len);
+		offset += iov[i].iov_len;
+	}
+	atomic_fetch_sub(&in_flight, 1);
+	return len;
+}
+
+/* Where new lines go in an existing file: right after its last newline */
+/* MT-Safe | AS-Unsafe | AC-Unsafe fd */
+static off_t recover_end(int fd)
+{
+	char buf[4096];
+	struct stat st;
+	off_t end;
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+	for (end = st.st_size; end > 0;) {
+		size_t len = min((off_t)sizeof(buf), end);
+		ssize_t ret = pread(fd, buf, len, end - len);
+
+		if (ret != (ssize_t)len)
+			return -1;
+		for (size_t i = len; i > 0; i--) {
+			if (buf[i - 1] == '\n')
+				return end - len + i;
+		}
+		end -= len;
+	}
+	return 0;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void stop_at_exit()
+{
+	lmmap_stop();
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+static void init_mapping()
+{
+	atexit(stop_at_exit);
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+int lmmap_start(const char *path, size_t extent_size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	off_t end;
+	int fd;
+
+	if (atomic_load(&mapping)) {
+		errno = EBUSY;
+		return -1;
+	}
+	pthread_once(&mapped_once, init_mapping);
+	fd = open(path, O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		dlperror("open");
+		return -1;
+	}
+	end = recover_end(fd);
+	if (end < 0 || ftruncate(fd, end) < 0) {
+		dlperror("ftruncate");
+		close(fd);
+		return -1;
+	}
+	base = mmap(NULL, MAPPED_MAX_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		dlperror("mmap");
+		close(fd);
+		return -1;
+	}
+	map_fd = fd;
+	extent = (max(extent_size, (size_t)MAPPED_MIN_EXTENT) + page - 1) & ~(page - 1);
+	/* Extents are mapped at file offsets that are multiples of extent, the first one covers end */
+	map_start = end - end % extent;
+	atomic_store(&mapped, map_start);
+	atomic_store(&reserved, end);
+	atomic_store(&growing, false);
+	if (grow(end + 1) < 0) {
+		dlperror("fallocate");
+		munmap(base, MAPPED_MAX_SIZE);
+		close(fd);
+		map_fd = -1;
+		return -1;
+	}
+	/* Stdio lines still sitting in thread buffers go out to the old file now rather than whenever they fill */
+	lflush();
+	atomic_store(&mapping, true);
+	return 0;
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+void lmmap_stop()
+{
+	unsigned long long end;
+
+	if (!atomic_exchange(&mapping, false))
+		return;
+	while (atomic_load(&in_flight))
+		sched_yield();
+	end = min(atomic_load(&reserved), atomic_load(&mapped));
+	if (end > map_start)
+		msync(base + map_start, end - map_start, MS_SYNC);
+	munmap(base, MAPPED_MAX_SIZE);
+	if (ftruncate(map_fd, end) < 0)
+		dlperror("ftruncate");
+	close(map_fd);
+	map_fd = -1;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+unsigned long lmmap_dropped()
+{
+	return atomic_load(&dropped_lines);
+}
@@ -0,0 +1,158 @@
+#include <compiler.h>
+#include <log.h>
+#include <sink.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/* <Configurable_values without code changes> */
+#define RATELIMIT_SLOTS 1024		/* Call sites with a bucket of their own. Power of two */
+#define RATELIMIT_PROBES 8			/* Call sites that find no slot share their level's bucket */
+#define RATELIMIT_SUMMARY_MS 1000	/* How often suppressed counts get reported */
+/* </Configurable_values> */
+
+/*
+ * Each call site, told apart by its format string's address, gets a token bucket kept as a
+ * single atomic: the theoretical arrival time of its next line (GCRA). A line passes if that
+ * time is at most burst - 1 intervals ahead of now, and pushes it one interval further, with a
+ * CAS. Dropped lines are counted in the bucket, and the first caller past the next summary time
+ * reports and resets the counts. Levels without a limit return after a relaxed load.
+ */
+typedef struct {
+	atomic_ullong tat;				/* ns, CLOCK_MONOTONIC */
+	atomic_ulong suppressed;
+} Bucket;
+
+static atomic_int limited_levels;	/* Bit per level that has a limit */
+static atomic_ullong intervals[LOG_REMOTE];		/* ns between lines, per level */
+static atomic_ullong tolerances[LOG_REMOTE];	/* (burst - 1) intervals */
+static struct {
+	atomic_uintptr_t format;		/* 0 while free */
+	atomic_int level;
+	Bucket bucket;
+} sites[RATELIMIT_SLOTS];
+static Bucket shared[LOG_REMOTE];	/* Per level, for call sites that found no slot */
+static atomic_ullong next_summary;
+static atomic_ulong total_suppressed;
+static const char summary_format[] = "Suppressed %lu lines like \"%.*s\"\n";
+static const char shared_summary_format[] = "Suppressed %lu lines from other call sites\n";
+
+/* MT-safe | AS-safe | AC-safe */
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static Bucket *find_bucket(const char *format, int level)
+{
+	uintptr_t key = (uintptr_t)format;
+	unsigned int hash = (unsigned int)((key * 0x9E3779B97F4A7C15ull) >> 32);
+
+	for (int i = 0; i < RATELIMIT_PROBES; i++) {
+		int s = (hash + i) & (RATELIMIT_SLOTS - 1);
+		uintptr_t cur = atomic_load_explicit(&sites[s].format, memory_order_acquire);
+
+		if (!cur && atomic_compare_exchange_strong(&sites[s].format, &cur, key)) {
+			atomic_store_explicit(&sites[s].level, level, memory_order_release);
+			return &sites[s].bucket;
+		}
+		if (cur == key)
+			return &sites[s].bucket;
+	}
+	return &shared[level];
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static int format_length(const char *format)
+{
+	int len = 0;
+
+	while (format[len] && format[len] != '\n')
+		len++;
+	return len;
+}
+
+/* MT-safe locale | AS-safe | AC-safe */
+static void report(uint64_t now)
+{
+	unsigned long long due = atomic_load_explicit(&next_summary, memory_order_relaxed);
+
+	if (now < due || !atomic_compare_exchange_strong(&next_summary, &due, now + RATELIMIT_SUMMARY_MS * 1000000ull))
+		return;
+	for (int s = 0; s < RATELIMIT_SLOTS; s++) {
+		const char *format = (const char *)atomic_load_explicit(&sites[s].format, memory_order_acquire);
+		unsigned long n;
+
+		if (!format || !atomic_load_explicit(&sites[s].bucket.suppressed, memory_order_relaxed))
+			continue;
+		n = atomic_exchange(&sites[s].bucket.suppressed, 0);
+		/* A claimer that hasn't stored its level yet leaves the count for the next summary */
+		if (n)
+			llprintf(atomic_load_explicit(&sites[s].level, memory_order_acquire) ?: LOG_ERROR, summary_format, n, format_length(format), format);
+	}
+	for (int level = LOG_ERROR; level < LOG_REMOTE; level++) {
+		unsigned long n = atomic_load_explicit(&shared[level].suppressed, memory_order_relaxed) ? atomic_exchange(&shared[level].suppressed, 0) : 0;
+
+		if (n)
+			llprintf(level, shared_summary_format, n);
+	}
+}
+
+/* MT-safe locale | AS-safe | AC-safe */
+bool ratelimit_allow(int level, const char *format)
+{
+	unsigned long long interval, tolerance, cur;
+	uint64_t now;
+	Bucket *b;
+
+	if (likely(!(atomic_load_explicit(&limited_levels, memory_order_relaxed) & (1 << level))))
+		return true;
+	if (format == summary_format || format == shared_summary_format)
+		return true;
+
+	interval = atomic_load_explicit(&intervals[level], memory_order_relaxed);
+	tolerance = atomic_load_explicit(&tolerances[level], memory_order_relaxed);
+	now = now_ns();
+	b = find_bucket(format, level);
+	report(now);
+	cur = atomic_load_explicit(&b->tat, memory_order_relaxed);
+	do {
+		if (cur > now + tolerance) {
+			atomic_fetch_add_explicit(&b->suppressed, 1, memory_order_relaxed);
+			atomic_fetch_add_explicit(&total_suppressed, 1, memory_order_relaxed);
+			return false;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&b->tat, &cur, max(cur, now) + interval,
+		memory_order_relaxed, memory_order_relaxed));
+	return true;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+int lratelimit(int level, unsigned int rate, unsigned int burst)
+{
+	unsigned long long interval;
+
+	if (level < LOG_ERROR || level >= LOG_REMOTE) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!rate) {
+		atomic_fetch_and(&limited_levels, ~(1 << level));
+		return 0;
+	}
+	interval = 1000000000ull / rate ?: 1;
+	atomic_store_explicit(&intervals[level], interval, memory_order_relaxed);
+	atomic_store_explicit(&tolerances[level], (max(burst, 1u) - 1) * interval, memory_order_relaxed);
+	atomic_fetch_or(&limited_levels, 1 << level);
+	return 0;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+unsigned long lratelimit_suppressed()
+{
+	return atomic_load(&total_suppressed);
+}
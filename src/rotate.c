@@ -0,0 +1,457 @@
+#include <compiler.h>
+#include <log.h>
+#include <sink.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+
+/* <Configurable_values without code changes> */
+#define ROTATE_MAX_GENERATIONS 99
+#define COMPRESS_CHUNK 65536		/* Input bytes compressed between throttling pauses */
+#define COMPRESS_CPU_PERCENT 25		/* Share of a CPU the compressing thread may use, on top of running at idle priority */
+/* </Configurable_values> */
+
+/*
+ * Loggers only add the length of each line they write to stdout or stderr to a counter;
+ * the one that crosses max_size posts a semaphore, which is AS-safe. The rotating thread then
+ * shifts the old generations, renames the file and puts a new one over stdout and stderr with dup2.
+ * Writes already in flight finish in the renamed file, later ones land in the new file,
+ * so every line ends up in exactly one of them and no logger ever waits for the rotation.
+ * Another thread may gzip rotated generations. It only holds generations_lock while it looks
+ * for a file and while it renames its result, so rotating never waits for compression either.
+ */
+static atomic_bool rotating;
+static atomic_ullong written;		/* Bytes in the current file, as far as the library knows */
+static unsigned long long max_size;	/* 0 if size doesn't trigger rotation */
+static unsigned int interval;		/* Seconds, 0 if time doesn't trigger rotation */
+static unsigned int generations;
+static sem_t wakeup;
+static pthread_once_t rotate_once = PTHREAD_ONCE_INIT;
+static pthread_t rotator;
+static atomic_bool reopen_requested;	/* Set by lreopen(), e.g. from the SIGHUP handler */
+static pthread_mutex_t generations_lock = PTHREAD_MUTEX_INITIALIZER;	/* Held while path.N files get renamed */
+static atomic_int compress_level;	/* 0 while not compressing */
+static sem_t compress_work;
+static pthread_t compressor;
+static struct {
+	atomic_ulong files;
+	atomic_ullong bytes_in;
+	atomic_ullong bytes_out;
+	atomic_ullong cpu_ns;
+	atomic_ullong wall_ns;
+} compress_stats;
+
+/* MT-safe | AS-safe | AC-safe */
+void rotate_account(int fd, size_t len)
+{
+	unsigned long long before;
+
+	if (likely(!atomic_load_explicit(&rotating, memory_order_relaxed)))
+		return;
+	if (fd != STDOUT_FILENO && fd != STDERR_FILENO)
+		return;
+	before = atomic_fetch_add_explicit(&written, len, memory_order_relaxed);
+	if (max_size && before < max_size && before + len >= max_size)
+		sem_post(&wakeup);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static unsigned long long current_size()
+{
+	struct stat st;
+
+	return fstat(STDOUT_FILENO, &st) < 0 ? 0 : st.st_size;
+}
+
+/* MT-safe | AS-safe | AC-Unsafe fd */
+void reopen_if_requested()
+{
+	if (likely(!atomic_load_explicit(&reopen_requested, memory_order_relaxed)))
+		return;
+	if (!atomic_exchange(&reopen_requested, false))
+		return;
+	if (reopen_stdio() < 0)
+		dlperror("reopen_stdio");
+	atomic_store(&written, current_size());
+}
+
+/* MT-safe | AS-safe | AC-safe */
+void lreopen()
+{
+	atomic_store(&reopen_requested, true);
+	/* Without it an idle process would keep the old file open until its next line */
+	if (atomic_load(&rotating))
+		sem_post(&wakeup);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static void reopen_signal_handler(int signum)
+{
+	(void)signum;
+	lreopen();
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+int setup_reopen_signal(int signum)
+{
+	struct sigaction sa = { .sa_handler = reopen_signal_handler, .sa_flags = SA_RESTART };
+
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(signum, &sa, NULL) < 0) {
+		dlperror("sigaction");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Next multiple of interval since the last midnight, in the local time lines are stamped with.
+ * Intervals that don't divide a day start over at midnight
+ */
+/* MT-safe | AS-safe | AC-safe */
+static time_t next_boundary(time_t now)
+{
+	time_t midnight, next;
+	int gmtoff;
+
+	timestamp_settings(&gmtoff);
+	midnight = now - (now + gmtoff) % 86400;
+	next = midnight + ((now - midnight) / interval + 1) * interval;
+	if (interval < 86400)
+		next = min(next, midnight + 86400);
+	return next;
+}
+
+/* MT-safe | AS-Unsafe locale | AC-safe */
+static void generation_name(char *name, const char *path, unsigned int i, bool compressed)
+{
+	snprintf(name, PATH_MAX, compressed ? "%s.%u.gz" : "%s.%u", path, i);
+}
+
+/* path.N-1 -> path.N, ..., path -> path.1, then a fresh path over stdout and stderr */
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void rotate(const char *path)
+{
+	char from[PATH_MAX], to[PATH_MAX];
+
+	pthread_mutex_lock(&generations_lock);
+	/* Either form of a generation may exist, so the oldest goes first instead of being overwritten */
+	for (int compressed = 0; generations && compressed < 2; compressed++) {
+		generation_name(to, path, generations, compressed);
+		if (unlink(to) < 0 && errno != ENOENT)
+			dlperror("unlink");
+	}
+	for (unsigned int i = generations; i > 1; i--) {
+		for (int compressed = 0; compressed < 2; compressed++) {
+			generation_name(from, path, i - 1, compressed);
+			generation_name(to, path, i, compressed);
+			if (rename(from, to) < 0 && errno != ENOENT)
+				dlperror("rename");
+		}
+	}
+	if (generations) {
+		generation_name(to, path, 1, false);
+		if (rename(path, to) < 0) {
+			pthread_mutex_unlock(&generations_lock);
+			dlperror("rename");
+			return;
+		}
+	}
+	else if (unlink(path) < 0 && errno != ENOENT) {
+		pthread_mutex_unlock(&generations_lock);
+		dlperror("unlink");
+		return;
+	}
+	/* Until stdout and stderr point at the new file, the compressor mustn't take path.1 from under writers */
+	if (reopen_stdio() < 0)
+		dlperror("reopen_stdio");
+	pthread_mutex_unlock(&generations_lock);
+	atomic_store(&written, current_size());
+	if (generations && atomic_load(&compress_level))
+		sem_post(&compress_work);
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void *rotator_main(void *arg)
+{
+	const char *path = arg;
+	struct timespec now, deadline = { 0 };
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (interval)
+		deadline.tv_sec = next_boundary(now.tv_sec);
+	while (atomic_load(&rotating)) {
+		if (interval)
+			sem_timedwait(&wakeup, &deadline);
+		else
+			sem_wait(&wakeup);
+		if (!atomic_load(&rotating))
+			break;
+		reopen_if_requested();
+		clock_gettime(CLOCK_REALTIME, &now);
+		if (interval && now.tv_sec >= deadline.tv_sec) {
+			deadline.tv_sec = next_boundary(now.tv_sec);
+			rotate(path);
+		}
+		else if (max_size && atomic_load(&written) >= max_size)
+			rotate(path);
+	}
+	return NULL;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+	while (len) {
+		ssize_t ret = write(fd, buf, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* Writes in as a single gzip member to out, sleeping after every chunk to stay under COMPRESS_CPU_PERCENT. Gives up when compression gets turned off */
+/* MT-Unsafe race:compressor | AS-Unsafe heap | AC-Unsafe mem */
+static int compress_file(int in, int out, int level)
+{
+	static unsigned char src[COMPRESS_CHUNK], dst[COMPRESS_CHUNK];	/* Only touched by the compressing thread */
+	z_stream zs = { 0 };
+	ssize_t len;
+	int ret = 0;
+
+	if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+	do {
+		uint64_t cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID), spent;
+
+		len = read(in, src, sizeof(src));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -1;
+			break;
+		}
+		zs.next_in = src;
+		zs.avail_in = len;
+		do {
+			zs.next_out = dst;
+			zs.avail_out = sizeof(dst);
+			deflate(&zs, len ? Z_NO_FLUSH : Z_FINISH);
+			ret = write_all(out, dst, sizeof(dst) - zs.avail_out);
+		} while (!ret && !zs.avail_out);
+		if (ret || !atomic_load(&compress_level)) {
+			ret = -1;
+			break;
+		}
+		spent = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+		atomic_fetch_add(&compress_stats.cpu_ns, spent);
+		spent = spent * (100 - COMPRESS_CPU_PERCENT) / COMPRESS_CPU_PERCENT;
+		nanosleep(&(struct timespec){ .tv_sec = spent / 1000000000, .tv_nsec = spent % 1000000000 }, NULL);
+	} while (len);
+	if (!ret) {
+		atomic_fetch_add(&compress_stats.bytes_in, zs.total_in);
+		atomic_fetch_add(&compress_stats.bytes_out, zs.total_out);
+	}
+	deflateEnd(&zs);
+	return ret;
+}
+
+/* Compresses the oldest uncompressed generation. Returns 0 once there are none left */
+/* MT-Unsafe race:compressor | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+static int compress_generation(const char *path)
+{
+	char name[PATH_MAX], tmp[PATH_MAX], compressed[PATH_MAX];
+	unsigned char magic[2];
+	struct stat st, cur;
+	uint64_t start = clock_ns(CLOCK_MONOTONIC);
+	unsigned int i;
+	int in = -1, out = -1, ret = 0;
+	bool gzipped;
+
+	pthread_mutex_lock(&generations_lock);
+	for (i = ROTATE_MAX_GENERATIONS; i && in < 0; i--) {
+		generation_name(name, path, i, false);
+		in = open(name, O_RDONLY | O_CLOEXEC);
+	}
+	pthread_mutex_unlock(&generations_lock);
+	if (in < 0)
+		return 0;
+	if (fstat(in, &st) < 0) {
+		dlperror("fstat");
+		close(in);
+		return -1;
+	}
+	/* Files written under lasync_compress only need the suffix */
+	gzipped = pread(in, magic, sizeof(magic), 0) == sizeof(magic) && magic[0] == 0x1f && magic[1] == 0x8b;
+	snprintf(tmp, sizeof(tmp), "%s.gz.tmp", path);
+	if (!gzipped) {
+		out = open(tmp, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0600);
+		if (out < 0) {
+			dlperror("open");
+			close(in);
+			return -1;
+		}
+		/* The source only goes away once its compressed copy is safely on disk */
+		ret = compress_file(in, out, atomic_load(&compress_level));
+		if (!ret && (ret = fdatasync(out)) < 0)
+			dlperror("fdatasync");
+		close(out);
+	}
+
+	/* Rotation may have shifted the file to another generation meanwhile, or dropped it */
+	pthread_mutex_lock(&generations_lock);
+	/* A write that was in flight during the rotation landed after the copy. The next rotation retries */
+	if (!ret && !gzipped && (fstat(in, &cur) < 0 || cur.st_size != lseek(in, 0, SEEK_CUR)))
+		ret = -1;
+	close(in);
+	for (i = 1; !ret && i <= ROTATE_MAX_GENERATIONS; i++) {
+		generation_name(name, path, i, false);
+		if (!stat(name, &cur) && cur.st_ino == st.st_ino && cur.st_dev == st.st_dev)
+			break;
+	}
+	if (!ret && i <= ROTATE_MAX_GENERATIONS) {
+		generation_name(compressed, path, i, true);
+		if ((ret = rename(gzipped ? name : tmp, compressed)) < 0)
+			dlperror("rename");
+		else if (!gzipped)
+			unlink(name);
+	}
+	if (!gzipped && (ret || i > ROTATE_MAX_GENERATIONS))
+		unlink(tmp);
+	pthread_mutex_unlock(&generations_lock);
+	if (!ret && !gzipped) {
+		atomic_fetch_add(&compress_stats.files, 1);
+		atomic_fetch_add(&compress_stats.wall_ns, clock_ns(CLOCK_MONOTONIC) - start);
+	}
+	return ret < 0 ? -1 : 1;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void *compressor_main(void *arg)
+{
+	const char *path = arg;
+	struct sched_param param = { 0 };
+
+	/* Only runs when nothing else wants the CPU, or at least yields to everything else */
+	if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param))
+		setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+	while (atomic_load(&compress_level)) {
+		/* A file that fails is retried after the next rotation */
+		while (atomic_load(&compress_level) && compress_generation(path) > 0);
+		sem_wait(&compress_work);
+	}
+	return NULL;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void init_rotation()
+{
+	/* Never destroyed or initialized again, loggers and rotate() may post them at any time */
+	if (sem_init(&wakeup, 0, 0) < 0 || sem_init(&compress_work, 0, 0) < 0)
+		dlperror("sem_init");
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+int lrotate_compress(int level)
+{
+	const char *path = stdio_path();
+	int ret;
+
+	if (!level) {
+		if (atomic_exchange(&compress_level, 0)) {
+			sem_post(&compress_work);
+			pthread_join(compressor, NULL);
+		}
+		return 0;
+	}
+	if (!path || level < Z_BEST_SPEED || level > Z_BEST_COMPRESSION || atomic_load(&compress_level)) {
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_once(&rotate_once, init_rotation);
+	atomic_store(&compress_level, level);
+	ret = pthread_create(&compressor, NULL, compressor_main, (void *)path);
+	if (ret) {
+		atomic_store(&compress_level, 0);
+		errno = ret;
+		dlperror("pthread_create");
+		return -1;
+	}
+	return 0;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+void lrotate_compress_stats(LogCompressStats *stats)
+{
+	stats->files = atomic_load(&compress_stats.files);
+	stats->bytes_in = atomic_load(&compress_stats.bytes_in);
+	stats->bytes_out = atomic_load(&compress_stats.bytes_out);
+	stats->cpu_ns = atomic_load(&compress_stats.cpu_ns);
+	stats->wall_ns = atomic_load(&compress_stats.wall_ns);
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+int lrotate_start(size_t size, unsigned int interval_s, unsigned int keep)
+{
+	const char *path = stdio_path();
+	int ret;
+
+	if (!path || atomic_load(&rotating) || keep > ROTATE_MAX_GENERATIONS || (!size && !interval_s)) {
+		errno = EINVAL;
+		return -1;
+	}
+	max_size = size;
+	interval = interval_s;
+	generations = keep;
+	pthread_once(&rotate_once, init_rotation);
+	atomic_store(&written, current_size());
+	atomic_store(&rotating, true);
+	ret = pthread_create(&rotator, NULL, rotator_main, (void *)path);
+	if (ret) {
+		atomic_store(&rotating, false);
+		errno = ret;
+		dlperror("pthread_create");
+		return -1;
+	}
+	/* Already past the limit, e.g. after a restart */
+	if (max_size && atomic_load(&written) >= max_size)
+		sem_post(&wakeup);
+	return 0;
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+void lrotate_stop()
+{
+	if (!atomic_exchange(&rotating, false))
+		return;
+	sem_post(&wakeup);
+	pthread_join(rotator, NULL);
+}
@@ -0,0 +1,400 @@
+#include <compiler.h>
+#include <log.h>
+#include <sink.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/futex.h>
+
+/* <Configurable_values without code changes> */
+#define URING_ENTRIES 256		/* Lines in flight. Power of two */
+#define URING_SLOT_SIZE 2048	/* Longer lines get written synchronously */
+#define URING_FDS 1024			/* Lines to higher fds get written synchronously */
+#define URING_IDLE_TIMEOUT_MS 100	/* Reaper re-checks the submission queue at least this often even without wakeups */
+//#define URING_SQPOLL			/* A kernel thread picks up submissions, so logging calls make no syscall at all. It spins for a second after the last line. Its batches may overlap, so lines can land out of order */
+/* </Configurable_values> */
+
+/*
+ * A logging thread claims a slot of a registered buffer, copies its line there and queues a
+ * WRITE_FIXED for it. Only queueing takes a spinlock, which is tried a few times and never waited
+ * on, so a signal handler can't deadlock and contention or a full ring fall back to write(2).
+ * The reaper thread submits everything queued as one chain of IOSQE_IO_LINK writes, with
+ * IOSQE_ASYNC so the kernel's workers do them, and submits the next chain once it completed:
+ * the caller never waits for the disk and lines stay in order, whatever the fd. io-wq alone only
+ * serializes buffered writes to regular files, and not reliably. Submitting from the reaper also
+ * keeps logging threads' exits from cancelling their writes. A line that has to be written
+ * synchronously first waits until as many writes to its fd completed as had been queued, which
+ * covers every earlier line of its thread. The reaper also finishes short writes and frees slots.
+ */
+#define URING_STOP UINT64_MAX	/* user_data of the NOP that tells the reaper to finish */
+
+static struct {
+	int fd;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_flags, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	struct io_uring_sqe *sqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+	bool fixed;				/* Slots are a registered buffer */
+	bool sqpoll;
+} ring = { .fd = -1, .sq_ring = MAP_FAILED, .cq_ring = MAP_FAILED, .sqes = MAP_FAILED };
+static atomic_bool running;
+static atomic_int in_flight;			/* Producers that may still queue */
+static atomic_bool sq_lock;
+static atomic_uint cursor;				/* Where producers start looking for a free slot */
+static atomic_bool slot_busy[URING_ENTRIES];
+static atomic_int slots_used;
+static int slot_fd[URING_ENTRIES];
+static unsigned int slot_len[URING_ENTRIES];
+static char *slots = MAP_FAILED;
+static atomic_uint fd_queued[URING_FDS];		/* Writes queued, counted under sq_lock */
+static atomic_uint fd_completed[URING_FDS];		/* Writes completed, in the order they were queued */
+static pthread_t reaper;
+static atomic_uint reaper_sleeping;		/* Futex word */
+
+/* MT-safe | AS-safe | AC-safe */
+static int uring_enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static void futex_wait(atomic_uint *word, unsigned int expected, long timeout_ms)
+{
+	struct timespec ts = { .tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000 };
+
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, &ts, NULL, 0);
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static unsigned int sq_pending()
+{
+	return __atomic_load_n(ring.sq_tail, __ATOMIC_SEQ_CST) - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+}
+
+/* Has whatever is queued submitted, other producers' lines included */
+/* MT-safe | AS-safe | AC-safe */
+static void submit()
+{
+	if (ring.sqpoll) {
+		if (__atomic_load_n(ring.sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)
+			uring_enter(0, 0, IORING_ENTER_SQ_WAKEUP);
+		return;
+	}
+	/* Pairs with the reaper's store of reaper_sleeping before it looks at the queue */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&reaper_sleeping) && atomic_exchange(&reaper_sleeping, 0))
+		syscall(SYS_futex, &reaper_sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Returns false if the submission queue is full. Caller holds sq_lock */
+/* MT-safe | AS-safe | AC-safe */
+static bool queue_sqe(const struct io_uring_sqe *sqe)
+{
+	unsigned int tail = *ring.sq_tail, index = tail & *ring.sq_mask;
+
+	if (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= *ring.sq_entries)
+		return false;
+	ring.sqes[index] = *sqe;
+	ring.sq_array[index] = index;
+	__atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_SEQ_CST);
+	return true;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static bool lock_sq(int attempts)
+{
+	while (atomic_exchange_explicit(&sq_lock, true, memory_order_acquire)) {
+		if (--attempts <= 0)
+			return false;
+		sched_yield();
+	}
+	return true;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+static void release_slot(int slot)
+{
+	atomic_fetch_sub(&slots_used, 1);
+	atomic_store_explicit(&slot_busy[slot], false, memory_order_release);
+}
+
+/* Waits for the lines queued for fd before the caller's, so its write(2) lands after them */
+/* MT-safe | AS-safe | AC-safe */
+static int fall_back(int fd)
+{
+	unsigned int target = atomic_load(&fd_queued[fd]);
+
+	submit();
+	while ((int)(atomic_load(&fd_completed[fd]) - target) < 0)
+		sched_yield();
+	atomic_fetch_sub(&in_flight, 1);
+	return -1;
+}
+
+/* MT-safe | AS-safe | AC-safe */
+int uring_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct io_uring_sqe sqe;
+	size_t len = 0;
+	int slot = -1;
+	bool queued = false;
+	char *buf;
+
+	if (likely(!atomic_load_explicit(&running, memory_order_relaxed)))
+		return -1;
+	if (fd < 0 || fd >= URING_FDS)
+		return -1;
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	atomic_fetch_add(&in_flight, 1);
+	if (!atomic_load(&running)) {
+		atomic_fetch_sub(&in_flight, 1);
+		return -1;
+	}
+	if (len > URING_SLOT_SIZE)
+		return fall_back(fd);
+
+	/* Slots are mostly freed in the order they were taken, so the first try nearly always succeeds */
+	for (int i = 0; i < URING_ENTRIES && slot < 0; i++) {
+		int s = atomic_fetch_add_explicit(&cursor, 1, memory_order_relaxed) & (URING_ENTRIES - 1);
+		bool expected = false;
+
+		if (atomic_compare_exchange_strong_explicit(&slot_busy[s], &expected, true, memory_order_acquire, memory_order_relaxed))
+			slot = s;
+	}
+	if (slot < 0)
+		return fall_back(fd);
+	atomic_fetch_add(&slots_used, 1);
+	buf = slots + (size_t)slot * URING_SLOT_SIZE;
+	for (int i = 0; i < iovcnt; i++) {
+		memcpy(buf, iov[i].iov_base, iov[i].iov_len);
+		buf += iov[i].iov_len;
+	}
+	slot_fd[slot] = fd;
+	slot_len[slot] = len;
+	sqe = (struct io_uring_sqe){
+		.opcode = ring.fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+		.flags = IOSQE_ASYNC | IOSQE_IO_LINK,
+		.fd = fd,
+		.off = (uint64_t)-1,	/* The file position, i.e. the end with O_APPEND */
+		.addr = (uintptr_t)(slots + (size_t)slot * URING_SLOT_SIZE),
+		.len = len,
+		.buf_index = 0,
+		.user_data = slot
+	};
+	if (lock_sq(100)) {
+		queued = queue_sqe(&sqe);
+		if (queued)
+			atomic_fetch_add(&fd_queued[fd], 1);
+		atomic_store_explicit(&sq_lock, false, memory_order_release);
+	}
+	if (!queued) {
+		release_slot(slot);
+		return fall_back(fd);
+	}
+	submit();
+	atomic_fetch_sub(&in_flight, 1);
+	return len;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void complete(int slot, int res)
+{
+	const char *buf = slots + (size_t)slot * URING_SLOT_SIZE;
+	size_t written = res > 0 ? res : 0;
+
+	/* Failed and short writes get finished synchronously. They break the chain, and the writes after them come back cancelled, in order */
+	while (written < slot_len[slot]) {
+		ssize_t ret = write(slot_fd[slot], buf + written, slot_len[slot] - written);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		written += ret;
+	}
+	rotate_account(slot_fd[slot], written);
+	atomic_fetch_add(&fd_completed[slot_fd[slot]], 1);
+	release_slot(slot);
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe */
+static void *reaper_main(void *arg)
+{
+	bool stopping = false;
+	unsigned int submitted = 0;		/* Not completed yet, unknown with SQPOLL */
+
+	(void)arg;
+	while (!stopping || atomic_load(&slots_used)) {
+		unsigned int head, tail, pending;
+
+		if (!ring.sqpoll) {
+			if (!submitted) {
+				atomic_store(&reaper_sleeping, 1);
+				if (!sq_pending())
+					futex_wait(&reaper_sleeping, 1, URING_IDLE_TIMEOUT_MS);
+				atomic_store(&reaper_sleeping, 0);
+			}
+			/* Lines queued meanwhile form the next chain */
+			if (!submitted && (pending = sq_pending())) {
+				int ret = uring_enter(pending, 0, 0);
+
+				if (ret > 0)
+					submitted += ret;
+			}
+		}
+		if (ring.sqpoll || submitted)
+			uring_enter(0, 1, IORING_ENTER_GETEVENTS);
+		head = *ring.cq_head;
+		tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		if (!ring.sqpoll)
+			submitted -= tail - head;
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+
+			if (cqe->user_data == URING_STOP)
+				stopping = true;
+			else
+				complete(cqe->user_data, cqe->res);
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/* MT-Safe | AS-Unsafe | AC-Unsafe fd mem */
+static void close_ring()
+{
+	if (ring.sqes != MAP_FAILED)
+		munmap(ring.sqes, ring.sqes_size);
+	if (ring.cq_ring != MAP_FAILED && ring.cq_ring != ring.sq_ring)
+		munmap(ring.cq_ring, ring.cq_ring_size);
+	if (ring.sq_ring != MAP_FAILED)
+		munmap(ring.sq_ring, ring.sq_ring_size);
+	if (ring.fd >= 0)
+		close(ring.fd);
+	if (slots != MAP_FAILED)
+		munmap(slots, (size_t)URING_ENTRIES * URING_SLOT_SIZE);
+	ring = (typeof(ring)){ .fd = -1, .sq_ring = MAP_FAILED, .cq_ring = MAP_FAILED, .sqes = MAP_FAILED };
+	slots = MAP_FAILED;
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+int luring_start()
+{
+	struct io_uring_params p = { 0 };
+	struct iovec buffers;
+	int ret;
+
+	if (atomic_load(&running) || ring.fd >= 0) {
+		errno = EBUSY;
+		return -1;
+	}
+	#ifdef URING_SQPOLL
+		p.flags = IORING_SETUP_SQPOLL;
+		p.sq_thread_idle = 1000;
+		ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+		ring.sqpoll = ring.fd >= 0;
+		if (ring.fd < 0)
+			p = (struct io_uring_params){ 0 };
+	#endif
+	if (ring.fd < 0)
+		ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (ring.fd < 0) {
+		dlperror("io_uring_setup");
+		return -1;
+	}
+	/* Appending at the file position needs 5.6 */
+	if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+		close_ring();
+		errno = ENOSYS;
+		return -1;
+	}
+
+	ring.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring.cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring.sq_ring_size = ring.cq_ring_size = max(ring.sq_ring_size, ring.cq_ring_size);
+	ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	if (ring.sq_ring != MAP_FAILED)
+		ring.cq_ring = (p.features & IORING_FEAT_SINGLE_MMAP) ? ring.sq_ring :
+			mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+	if (ring.cq_ring != MAP_FAILED)
+		ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	slots = mmap(NULL, (size_t)URING_ENTRIES * URING_SLOT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (ring.sqes == MAP_FAILED || slots == MAP_FAILED) {
+		dlperror("mmap");
+		close_ring();
+		return -1;
+	}
+	ring.sq_head = (unsigned int *)((char *)ring.sq_ring + p.sq_off.head);
+	ring.sq_tail = (unsigned int *)((char *)ring.sq_ring + p.sq_off.tail);
+	ring.sq_mask = (unsigned int *)((char *)ring.sq_ring + p.sq_off.ring_mask);
+	ring.sq_entries = (unsigned int *)((char *)ring.sq_ring + p.sq_off.ring_entries);
+	ring.sq_flags = (unsigned int *)((char *)ring.sq_ring + p.sq_off.flags);
+	ring.sq_array = (unsigned int *)((char *)ring.sq_ring + p.sq_off.array);
+	ring.cq_head = (unsigned int *)((char *)ring.cq_ring + p.cq_off.head);
+	ring.cq_tail = (unsigned int *)((char *)ring.cq_ring + p.cq_off.tail);
+	ring.cq_mask = (unsigned int *)((char *)ring.cq_ring + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *)((char *)ring.cq_ring + p.cq_off.cqes);
+
+	/* Pinned pages count against RLIMIT_MEMLOCK, plain WRITEs do without */
+	buffers = (struct iovec){ .iov_base = slots, .iov_len = (size_t)URING_ENTRIES * URING_SLOT_SIZE };
+	ring.fixed = !syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, &buffers, 1);
+
+	for (int i = 0; i < URING_ENTRIES; i++)
+		atomic_store(&slot_busy[i], false);
+	for (int i = 0; i < URING_FDS; i++) {
+		atomic_store(&fd_queued[i], 0);
+		atomic_store(&fd_completed[i], 0);
+	}
+	atomic_store(&slots_used, 0);
+	atomic_store(&sq_lock, false);
+	atomic_store(&reaper_sleeping, 0);
+	atomic_store(&running, true);
+	ret = pthread_create(&reaper, NULL, reaper_main, NULL);
+	if (ret) {
+		atomic_store(&running, false);
+		close_ring();
+		errno = ret;
+		dlperror("pthread_create");
+		return -1;
+	}
+	return 0;
+}
+
+/* MT-Safe | AS-Unsafe heap lock | AC-Unsafe lock mem fd */
+void luring_stop()
+{
+	struct io_uring_sqe nop = { .opcode = IORING_OP_NOP, .user_data = URING_STOP };
+
+	if (!atomic_exchange(&running, false))
+		return;
+	while (atomic_load(&in_flight))
+		sched_yield();
+	/* The reaper leaves once it saw this and every write completed */
+	for (;;) {
+		bool queued;
+
+		lock_sq(INT32_MAX);
+		queued = queue_sqe(&nop);
+		atomic_store_explicit(&sq_lock, false, memory_order_release);
+		if (queued)
+			break;
+		submit();
+		sched_yield();
+	}
+	submit();
+	pthread_join(reaper, NULL);
+	close_ring();
+}
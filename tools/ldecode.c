@@ -0,0 +1,431 @@
+/* Renders binary logs written by lbinary_start(fd) as the lines the library would have written in place */
+#include <compiler.h>
+#include <log.h>
+#include <layout.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define NANOPRINTF_VISIBILITY_STATIC
+#define NANOPRINTF_IMPLEMENTATION
+#include <nanoprintf.h>
+#include <binlog.h>
+
+/* <Configurable_values without code changes> */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define READ_CHUNK_SIZE (1 << 20)	/* For input that can't be mapped, e.g. pipes */
+#define MAX_LINE_SIZE 65536			/* Longer lines get cut */
+/* </Configurable_values> */
+
+typedef struct {
+	uint64_t address;	/* 0 while free */
+	const char *string;
+} Format;
+
+typedef struct {
+	int64_t ns;			/* Since the epoch, in the writer's local time unless absolute */
+	bool absolute;		/* Had a UTC offset or was given as seconds since the epoch */
+	bool set;
+} TimeBound;
+
+static struct {
+	Format *formats;	/* Open addressing, power-of-two capacity */
+	size_t capacity, count;
+	bool copy_strings;	/* Input buffer gets reused, so format strings can't point into it */
+	bool started;
+	int gmtoff, mode;
+	uint64_t from_ns, to_ns;
+} stream;
+
+static int max_level = LOG_DEBUG;
+static TimeBound from, to;
+static char output[OUTPUT_BUFFER_SIZE];
+static size_t output_len;
+static unsigned long unknown_formats;
+static struct {
+	int64_t second;
+	int gmtoff, mode, len;
+	char prefix[timestamp_size];
+} timestamp_cache = { .second = -1 };
+
+static void flush_output()
+{
+	for (size_t written = 0; written < output_len;) {
+		ssize_t ret = write(STDOUT_FILENO, output + written, output_len - written);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EPIPE)
+				perror("ldecode: write");
+			exit(1);
+		}
+		written += ret;
+	}
+	output_len = 0;
+}
+
+static void forget_formats()
+{
+	for (size_t i = 0; i < stream.capacity; i++) {
+		if (stream.copy_strings && stream.formats[i].address)
+			free((char *)stream.formats[i].string);
+		stream.formats[i].address = 0;
+	}
+	stream.count = 0;
+}
+
+static size_t format_slot(const Format *formats, size_t capacity, uint64_t address)
+{
+	size_t i = (address * 0x9E3779B97F4A7C15ull) >> 20;
+
+	for (i &= capacity - 1; formats[i].address && formats[i].address != address; i = (i + 1) & (capacity - 1));
+	return i;
+}
+
+static const char *find_format(uint64_t address)
+{
+	size_t i;
+
+	if (!stream.capacity)
+		return NULL;
+	i = format_slot(stream.formats, stream.capacity, address);
+	return stream.formats[i].address ? stream.formats[i].string : NULL;
+}
+
+static void add_format(uint64_t address, const char *string)
+{
+	size_t i;
+
+	/* Keep the table at most half full */
+	if ((stream.count + 1) * 2 > stream.capacity) {
+		size_t capacity = stream.capacity ? stream.capacity * 2 : 1024;
+		Format *formats = calloc(capacity, sizeof(*formats));
+
+		if (!formats) {
+			perror("ldecode: calloc");
+			exit(1);
+		}
+		for (size_t j = 0; j < stream.capacity; j++) {
+			if (stream.formats[j].address)
+				formats[format_slot(formats, capacity, stream.formats[j].address)] = stream.formats[j];
+		}
+		free(stream.formats);
+		stream.formats = formats;
+		stream.capacity = capacity;
+	}
+	i = format_slot(stream.formats, stream.capacity, address);
+	if (stream.formats[i].address) {
+		/* Repeated definition, e.g. written by two threads at once */
+		if (!stream.copy_strings)
+			return;
+		free((char *)stream.formats[i].string);
+	}
+	else
+		stream.count++;
+	if (stream.copy_strings && !(string = strdup(string))) {
+		perror("ldecode: strdup");
+		exit(1);
+	}
+	stream.formats[i] = (Format){ .address = address, .string = string };
+}
+
+static uint64_t resolve_bound(const TimeBound *bound, uint64_t unset)
+{
+	int64_t ns;
+
+	if (!bound->set)
+		return unset;
+	ns = bound->ns - (bound->absolute ? 0 : (int64_t)stream.gmtoff * 1000000000);
+	return max(ns, (int64_t)0);
+}
+
+static void render_line(const BinlogRecord *rec, const char *args, size_t args_len)
+{
+	const char *format = find_format(rec->format);
+	int64_t second = rec->time_ns / 1000000000;
+	char *line;
+
+	if (output_len + timestamp_size + max_tag_size + MAX_LINE_SIZE > sizeof(output))
+		flush_output();
+	line = output + output_len;
+
+	if (second != timestamp_cache.second || stream.mode != timestamp_cache.mode || stream.gmtoff != timestamp_cache.gmtoff) {
+		timestamp_cache.len = format_timestamp(second, stream.mode, stream.gmtoff, timestamp_cache.prefix);
+		timestamp_cache.second = second;
+		timestamp_cache.mode = stream.mode;
+		timestamp_cache.gmtoff = stream.gmtoff;
+	}
+	memcpy(line, timestamp_cache.prefix, timestamp_cache.len);
+	put_timestamp_fraction(line, stream.mode, rec->time_ns % 1000000000);
+	line += timestamp_cache.len;
+	if (rec->tag <= LOG_REMOTE) {
+		memcpy(line, log_tags[rec->tag], log_tag_lengths[rec->tag]);
+		line += log_tag_lengths[rec->tag];
+	}
+	if (likely(format))
+		line += binlog_render(format, args, args_len, line, MAX_LINE_SIZE);
+	else {
+		unknown_formats++;
+		line += npf_snprintf(line, MAX_LINE_SIZE, "<unknown format %#lx>\n", (unsigned long)rec->format);
+	}
+	output_len = line - output;
+}
+
+/* Decodes every complete record in data. Returns the bytes consumed, -1 on a corrupt stream */
+static long decode(const char *data, size_t len, const char *name, uint64_t offset)
+{
+	const char *p = data, *end = data + len;
+
+	while ((size_t)(end - p) >= sizeof(BinlogRecord)) {
+		BinlogRecord rec;
+
+		memcpy(&rec, p, sizeof(rec));
+		if (rec.size < sizeof(rec) || (!stream.started && rec.type != BINLOG_START)) {
+			fprintf(stderr, "ldecode: %s: not a binary log or corrupt at offset %lu\n", name, (unsigned long)(offset + (p - data)));
+			return -1;
+		}
+		if ((size_t)(end - p) < rec.size)
+			break;
+
+		switch (rec.type) {
+			case BINLOG_START: {
+				BinlogStart start;
+
+				if (rec.size < sizeof(rec) + sizeof(start) || memcmp(p + sizeof(rec), BINLOG_MAGIC, sizeof(BINLOG_MAGIC))) {
+					fprintf(stderr, "ldecode: %s: bad stream header at offset %lu\n", name, (unsigned long)(offset + (p - data)));
+					return -1;
+				}
+				memcpy(&start, p + sizeof(rec), sizeof(start));
+				forget_formats();
+				stream.started = true;
+				stream.gmtoff = start.gmtoff;
+				stream.mode = start.timestamp_mode;
+				stream.from_ns = resolve_bound(&from, 0);
+				stream.to_ns = resolve_bound(&to, UINT64_MAX);
+			}	break;
+			case BINLOG_FORMAT:
+				/* Strings are stored with their NULL byte, so they can be used in place */
+				if (rec.size > sizeof(rec) && !p[rec.size - 1])
+					add_format(rec.format, p + sizeof(rec));
+				break;
+			case BINLOG_LINE:
+				if ((rec.level <= max_level || rec.level == LOG_REMOTE) && rec.time_ns >= stream.from_ns && rec.time_ns <= stream.to_ns)
+					render_line(&rec, p + sizeof(rec), rec.size - sizeof(rec));
+				break;
+			default:	/* Written by a newer library, skip */
+				break;
+		}
+		p += rec.size;
+	}
+	return p - data;
+}
+
+static int decode_fd(int fd, const char *name)
+{
+	struct stat st;
+	char *data;
+	long consumed = 0;
+	size_t len = 0;
+	uint64_t offset = 0;
+
+	stream.started = false;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		if (!st.st_size)
+			return 0;
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			forget_formats();
+			stream.copy_strings = false;
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+			consumed = decode(data, st.st_size, name, 0);
+			if (consumed >= 0 && consumed < st.st_size)
+				fprintf(stderr, "ldecode: %s: ignoring %ld bytes of incomplete record at the end\n", name, (long)(st.st_size - consumed));
+			/* Format strings point into the mapping */
+			flush_output();
+			forget_formats();
+			munmap(data, st.st_size);
+			return consumed < 0 ? -1 : 0;
+		}
+	}
+
+	/* Pipes and the like: read in chunks, keeping an incomplete record for the next round */
+	forget_formats();
+	stream.copy_strings = true;
+	size_t capacity = READ_CHUNK_SIZE;
+	if (!(data = malloc(capacity))) {
+		perror("ldecode: malloc");
+		return -1;
+	}
+	for (;;) {
+		ssize_t ret;
+
+		if (capacity - len < READ_CHUNK_SIZE / 2) {
+			char *bigger = realloc(data, capacity * 2);
+
+			if (!bigger) {
+				perror("ldecode: realloc");
+				free(data);
+				return -1;
+			}
+			data = bigger;
+			capacity *= 2;
+		}
+		ret = read(fd, data + len, capacity - len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "ldecode: %s: %s\n", name, strerror(errno));
+			break;
+		}
+		if (!ret)
+			break;
+		len += ret;
+		consumed = decode(data, len, name, offset);
+		if (consumed < 0)
+			break;
+		memmove(data, data + consumed, len - consumed);
+		len -= consumed;
+		offset += consumed;
+	}
+	if (len && consumed >= 0)
+		fprintf(stderr, "ldecode: %s: ignoring %lu bytes of incomplete record at the end\n", name, (unsigned long)len);
+	free(data);
+	flush_output();
+	return consumed < 0 ? -1 : 0;
+}
+
+static int parse_level(const char *arg)
+{
+	static const char *names[] = { "NONE", "ERROR", "WARNING", "INFO", "DEBUG" };
+
+	for (int level = LOG_NONE; level <= LOG_DEBUG; level++) {
+		if (!strcasecmp(arg, names[level]) || (arg[0] == '0' + level && !arg[1]))
+			return level;
+	}
+	return -1;
+}
+
+/* Days since 1970-01-01 of a proleptic Gregorian date */
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = (unsigned)(y - era * 400);
+	unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+/* @SECONDS[.FRACTION] since the epoch, or YYYY-MM-DD[THH:MM[:SS[.FRACTION]]][Z|+HH:MM|-HH:MM], local to the writer without an offset */
+static bool parse_time(const char *arg, TimeBound *bound)
+{
+	int year, month, day, hour = 0, minute = 0, n = 0;
+	double seconds = 0;
+	const char *p;
+
+	if (arg[0] == '@') {
+		char *end;
+		double t = strtod(arg + 1, &end);
+
+		if (end == arg + 1 || *end)
+			return false;
+		*bound = (TimeBound){ .ns = (int64_t)(t * 1e9), .absolute = true, .set = true };
+		return true;
+	}
+	if (sscanf(arg, "%4d-%2d-%2d%n", &year, &month, &day, &n) != 3 || month < 1 || month > 12 || day < 1 || day > 31)
+		return false;
+	p = arg + n;
+	if (*p == 'T' || *p == ' ') {
+		n = 0;
+		if (sscanf(p + 1, "%2d:%2d%n", &hour, &minute, &n) != 2)
+			return false;
+		p += 1 + n;
+		if (*p == ':') {
+			char *end;
+
+			seconds = strtod(p + 1, &end);
+			if (end == p + 1)
+				return false;
+			p = end;
+		}
+	}
+	*bound = (TimeBound){ .ns = (int64_t)(((days_from_civil(year, month, day) * 24 + hour) * 60 + minute) * 60 * 1e9 + seconds * 1e9), .set = true };
+	if (*p == 'Z' && !p[1])
+		bound->absolute = true;
+	else if ((*p == '+' || *p == '-') && sscanf(p + 1, "%2d:%2d%n", &hour, &minute, &n) == 2 && !p[1 + n]) {
+		bound->ns -= (*p == '-' ? -1 : 1) * (int64_t)(hour * 60 + minute) * 60 * 1000000000;
+		bound->absolute = true;
+	}
+	else if (*p)
+		return false;
+	return true;
+}
+
+static void usage(FILE *out)
+{
+	fprintf(out,
+		"Usage: ldecode [-l LEVEL] [-s FROM] [-e UNTIL] [FILE]...\n"
+		"Renders binary logs written by lbinary_start(fd) as text. Reads standard input without FILE or for -.\n"
+		"  -l LEVEL  Show lines up to LEVEL: NONE, ERROR, WARNING, INFO or DEBUG (default). REMOTE lines are always shown\n"
+		"  -s FROM   Skip lines before FROM\n"
+		"  -e UNTIL  Skip lines after UNTIL\n"
+		"Times are @SECONDS since the epoch or YYYY-MM-DD[THH:MM[:SS[.FRACTION]]][Z|+HH:MM|-HH:MM],\n"
+		"the latter in the writer's local time when the offset is left out.\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "l:s:e:h")) != -1) {
+		switch (opt) {
+			case 'l':
+				if ((max_level = parse_level(optarg)) < 0) {
+					fprintf(stderr, "ldecode: unknown level %s\n", optarg);
+					return 2;
+				}
+				break;
+			case 's':
+			case 'e':
+				if (!parse_time(optarg, opt == 's' ? &from : &to)) {
+					fprintf(stderr, "ldecode: can't parse time %s\n", optarg);
+					return 2;
+				}
+				break;
+			case 'h':
+				usage(stdout);
+				return 0;
+			default:
+				usage(stderr);
+				return 2;
+		}
+	}
+
+	if (optind == argc)
+		ret = decode_fd(STDIN_FILENO, "-");
+	for (int i = optind; i < argc; i++) {
+		int fd = strcmp(argv[i], "-") ? open(argv[i], O_RDONLY) : STDIN_FILENO;
+
+		if (fd < 0) {
+			fprintf(stderr, "ldecode: %s: %s\n", argv[i], strerror(errno));
+			ret = -1;
+			continue;
+		}
+		if (decode_fd(fd, argv[i]) < 0)
+			ret = -1;
+		if (fd != STDIN_FILENO)
+			close(fd);
+	}
+	if (unknown_formats)
+		fprintf(stderr, "ldecode: %lu lines referred to formats missing from the stream\n", unknown_formats);
+	return ret ? 1 : 0;
+}